@@ -35,9 +35,12 @@
 #define NEOPIXEL_POWER          (20u)   // Neopixel power pin
 
 
-#define KMBOX_UART              uart1    // Use UART1 for KMBox (UART0 is for debug)
-#define KMBOX_UART_TX_PIN       (5u)     // GPIO5 for UART1 TX
-#define KMBOX_UART_RX_PIN       (6u)     // GPIO6 for UART1 RX
+#ifndef KMBOX_UART_TX_PIN
+#define KMBOX_UART_TX_PIN       (4u)     // GPIO4 is UART1 TX; the UART follows from the pins
+#endif
+#ifndef KMBOX_UART_RX_PIN
+#define KMBOX_UART_RX_PIN       (5u)     // GPIO5 is UART1 RX (UART0 is for debug)
+#endif
 #define KMBOX_UART_BAUDRATE     115200   // Standard baud rate for KMBox
 #define KMBOX_UART_FIFO_SIZE    32       // UART FIFO size for buffering
 
@@ -161,8 +164,9 @@
 #define USB_STACK_ERROR_THRESHOLD       50      // Number of consecutive errors before reset
 
 
-#define CONFIG_TOTAL_LEN                (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
-#define EPNUM_HID                       HID_ENDPOINT_ADDRESS
+#define HID_DEVICE_MAX_INTERFACES       4       // Device HID interfaces, one IN endpoint each (CFG_TUD_HID)
+#define CONFIG_MAX_LEN                  (TUD_CONFIG_DESC_LEN + HID_DEVICE_MAX_INTERFACES * TUD_HID_INOUT_DESC_LEN)
+#define EPNUM_HID                       HID_ENDPOINT_ADDRESS    // Interface N uses EPNUM_HID + N; an OUT endpoint shares the number
 
 
 
@@ -173,8 +177,9 @@
 
 
 
-#define HID_ENDPOINT_ADDRESS            0x81    // HID IN endpoint address (device mode)
-#define HID_POLLING_INTERVAL_MS         1       // HID polling interval in ms
+#define HID_ENDPOINT_ADDRESS            0x81    // First HID IN endpoint address (device mode)
+#define HID_POLLING_INTERVAL_MS         1       // HID polling interval in ms, unless mirrored from the attached device
+#define HID_KEYBOARD_EP_SIZE            32      // NKRO keyboard report is 30 bytes
 
 
 
@@ -184,13 +189,29 @@
 
 
 #define HID_KEYBOARD_KEYCODE_COUNT      6       // Number of simultaneous keycodes supported
-#define HID_CONSUMER_CONTROL_SIZE       2       // Consumer control report size in bytes
+#define HID_IDLE_RATE_UNIT_MS           4       // SET_IDLE duration unit
 
 
 #define KEYBOARD_ACTIVITY_THROTTLE      50      // Trigger keyboard activity flash every 50 reports
 #define MOUSE_ACTIVITY_THROTTLE         100     // Trigger mouse activity flash every 100 reports
 
 
+#define HID_EVENT_QUEUE_DEPTH           64      // Core 1 -> core 0 input event queue (power of two)
+#define HID_EVENT_DOORBELL              0x48494445u // Multicore FIFO word announcing queued events
+#define HID_REQUEST_QUEUE_DEPTH         8       // Core 0 -> core 1 SET/GET_REPORT queue (power of two)
+#define HID_REQUEST_TIMEOUT_MS          250     // Abandon a forwarded control transfer after this long
+#define HID_GET_REPORT_TIMEOUT_MS       (2 * HID_REQUEST_TIMEOUT_MS)    // Stall a forwarded GET_REPORT still unanswered after this long
+#define HID_MIRROR_QUEUE_DEPTH          4       // Per mirrored interface and direction (power of two)
+#define HID_MIRROR_IN_PER_FRAME         2       // Mirrored reports sent to the PC per frame, after the mouse
+#define HID_MIRROR_EVENT_HEADROOM       16      // Event queue slots mirrored reports leave for pointer and key events
+#define HID_MIRROR_OUT_INTERVAL_US      1000    // Minimum spacing of OUT reports sent to the attached device
+#define HID_HOST_POLL_INTERVAL_MS       1       // Poll attached devices' interrupt IN endpoints at least this often; 0 keeps bInterval
+#define HID_REENUM_SETTLE_MS            100     // Quiet time after the last host mount before re-enumerating
+#define HID_REENUM_DISCONNECT_MS        50      // Time off the bus; long enough for the PC to see the detach
+#define HID_REENUM_HOLDOFF_MS           100     // After reconnecting, before another cycle may start
+#define IDENTITY_CACHE_LOCKOUT_TIMEOUT_MS 100   // Wait for the other core to park before a flash write
+
+
 
 
 
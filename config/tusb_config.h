@@ -81,7 +81,7 @@
 #endif
 
 
-#define CFG_TUD_HID              1
+#define CFG_TUD_HID              4       // HID_DEVICE_MAX_INTERFACES: mouse, keyboard, mirrored interfaces
 
 
 #define CFG_TUD_HID_EP_BUFSIZE   64
@@ -0,0 +1,71 @@
+/*
+ * HID Gamepad State
+ * Axes, hat and buttons of a joystick or gamepad report, decoded through the
+ * plan's gamepad layout and written back in place so the rest of the report
+ * reaches the PC untouched
+ */
+
+#ifndef HID_GAMEPAD_H
+#define HID_GAMEPAD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hid_report_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+
+
+#define HID_GAMEPAD_AXIS_MAX        32767   // Normalized axes run -32767..32767 over the logical range
+#define HID_GAMEPAD_HAT_CENTER      8       // Directions 0-7 run clockwise from up
+#define HID_GAMEPAD_HAT_RELEASED    -1      // Override only: the device's own hat goes through
+
+
+
+
+
+typedef struct {
+    uint32_t buttons;                       // Bit 0 is the first button of the layout
+    int32_t axes[HID_PLAN_MAX_AXES];        // Logical units; X, Y, Z, Rx, Ry, Rz, Slider, Dial
+    int32_t hat;                            // Logical units, outside the range when centered
+} hid_gamepad_state_t;
+
+// Injected input laid over the device's own
+typedef struct {
+    uint32_t buttons;                       // Held pressed on top of the device's buttons
+    uint8_t axis_mask;                      // Axes held at axes[] instead of the device's value
+    int16_t axes[HID_PLAN_MAX_AXES];        // Normalized
+    int8_t hat;                             // 0-7, HID_GAMEPAD_HAT_CENTER or HID_GAMEPAD_HAT_RELEASED
+} hid_gamepad_override_t;
+
+
+
+
+
+// False when the report is not the layout's input report
+bool hid_gamepad_decode(const hid_gamepad_layout_t *layout, const uint8_t *report, uint16_t len,
+                        hid_gamepad_state_t *state);
+
+
+// Rewrites only the layout's fields; the report must be one hid_gamepad_decode accepted
+void hid_gamepad_encode(const hid_gamepad_layout_t *layout, const hid_gamepad_state_t *state, uint8_t *report);
+
+
+void hid_gamepad_apply_override(const hid_gamepad_layout_t *layout, const hid_gamepad_override_t *override,
+                                hid_gamepad_state_t *state);
+
+
+static inline bool hid_gamepad_override_active(const hid_gamepad_override_t *override)
+{
+    return override->buttons != 0 || override->axis_mask != 0 || override->hat != HID_GAMEPAD_HAT_RELEASED;
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HID_GAMEPAD_H
@@ -0,0 +1,92 @@
+/*
+ * HID Keyboard State
+ * Keyboard state as a 256-bit usage bitmap, decoded from any boot, 6KRO or
+ * NKRO report layout and encoded into the device's NKRO report
+ */
+
+#ifndef HID_KEYBOARD_H
+#define HID_KEYBOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hid_report_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+
+
+#define HID_KEY_BITMAP_WORDS        8       // 256 keyboard usages
+#define HID_KEY_MODIFIER_FIRST      0xE0    // Left Control; E0-E7 are the modifier bits
+#define HID_KEY_NKRO_USAGES         0xE0    // Usages 00-DF carried in the device bitmap
+#define HID_KEY_NKRO_REPORT_BYTES   (2 + HID_KEY_NKRO_USAGES / 8)   // Modifiers, reserved, bitmap
+
+
+
+
+
+typedef struct {
+    uint32_t words[HID_KEY_BITMAP_WORDS];
+} hid_key_bitmap_t;
+
+
+
+
+
+static inline void hid_key_bitmap_clear(hid_key_bitmap_t *keys)
+{
+    for (uint8_t i = 0; i < HID_KEY_BITMAP_WORDS; i++) {
+        keys->words[i] = 0;
+    }
+}
+
+static inline void hid_key_bitmap_set(hid_key_bitmap_t *keys, uint8_t usage, bool down)
+{
+    uint32_t const bit = 1u << (usage & 31u);
+    if (down) {
+        keys->words[usage >> 5] |= bit;
+    } else {
+        keys->words[usage >> 5] &= ~bit;
+    }
+}
+
+static inline bool hid_key_bitmap_test(const hid_key_bitmap_t *keys, uint8_t usage)
+{
+    return (keys->words[usage >> 5] >> (usage & 31u)) & 1u;
+}
+
+static inline void hid_key_bitmap_merge(hid_key_bitmap_t *out, const hid_key_bitmap_t *a, const hid_key_bitmap_t *b)
+{
+    for (uint8_t i = 0; i < HID_KEY_BITMAP_WORDS; i++) {
+        out->words[i] = a->words[i] | b->words[i];
+    }
+}
+
+static inline bool hid_key_bitmap_equal(const hid_key_bitmap_t *a, const hid_key_bitmap_t *b)
+{
+    uint32_t diff = 0;
+    for (uint8_t i = 0; i < HID_KEY_BITMAP_WORDS; i++) {
+        diff |= a->words[i] ^ b->words[i];
+    }
+    return diff == 0;
+}
+
+
+
+
+
+// False when the report is not a keyboard report or signals rollover; keep the previous state then
+bool hid_keyboard_decode(const hid_report_plan_t *plan, const uint8_t *report, uint16_t len, hid_key_bitmap_t *keys);
+
+
+// Writes HID_KEY_NKRO_REPORT_BYTES in the layout of TUD_HID_REPORT_DESC_KEYBOARD_NKRO
+void hid_keyboard_encode_nkro(const hid_key_bitmap_t *keys, uint8_t *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HID_KEYBOARD_H
@@ -0,0 +1,93 @@
+/*
+ * HID Mouse Decoder
+ * Selects a layout-specialized decoder for the attached mouse from its
+ * compiled report plan, with the generic plan walker as fallback
+ */
+
+#ifndef HID_MOUSE_DECODER_H
+#define HID_MOUSE_DECODER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "hid_report_parser.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+
+
+#define HID_DECODER_PROFILE_INTERVAL    256     // Profile one report in N against the generic path
+
+
+
+
+
+typedef struct {
+    uint16_t buttons;
+    int16_t x;
+    int16_t y;
+    int16_t wheel;
+    int16_t pan;
+} hid_mouse_sample_t;
+
+typedef struct hid_mouse_decoder hid_mouse_decoder_t;
+
+typedef bool (*hid_mouse_decode_fn)(const hid_mouse_decoder_t *decoder, const uint8_t *report, uint16_t len, hid_mouse_sample_t *out);
+
+struct hid_mouse_decoder {
+    hid_mouse_decode_fn decode;
+    const char *name;               // Layout name, "generic" when no fast path matched
+    bool fast_path;
+    bool check_report_id;
+    uint8_t report_id;
+    uint8_t report_bytes;
+    uint16_t buttons_mask;
+    uint32_t layout_fingerprint;    // Hash of the compiled pointer layout
+    uint32_t descriptor_hash;       // FNV-1a of the raw report descriptor
+    hid_report_plan_t plan;
+};
+
+// Cycles on the RP2350, microseconds on the RP2040
+typedef struct {
+    uint32_t fast_samples;
+    uint32_t fast_cycles;
+    uint32_t generic_samples;
+    uint32_t generic_cycles;
+    uint32_t mismatches;            // Fast and generic results differed while profiling
+} hid_decoder_stats_t;
+
+
+
+
+
+void hid_mouse_decoder_init(hid_mouse_decoder_t *decoder, const hid_report_plan_t *plan,
+                            const uint8_t *desc, uint16_t desc_len);
+
+
+static inline bool hid_mouse_decoder_decode(const hid_mouse_decoder_t *decoder, const uint8_t *report,
+                                            uint16_t len, hid_mouse_sample_t *out)
+{
+    return decoder->decode(decoder, report, len, out);
+}
+
+
+bool hid_mouse_decode_generic(const hid_mouse_decoder_t *decoder, const uint8_t *report, uint16_t len, hid_mouse_sample_t *out);
+
+
+void hid_mouse_decoder_profile(const hid_mouse_decoder_t *decoder, const uint8_t *report, uint16_t len);
+
+
+void hid_mouse_decoder_get_stats(hid_decoder_stats_t *stats);
+void hid_mouse_decoder_reset_stats(void);
+
+
+uint32_t hid_descriptor_hash(const uint8_t *desc, uint16_t desc_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HID_MOUSE_DECODER_H
@@ -0,0 +1,164 @@
+/*
+ * HID Report Descriptor Parser
+ * Compiles a HID report descriptor into per-report-ID field extraction plans
+ */
+
+#ifndef HID_REPORT_PARSER_H
+#define HID_REPORT_PARSER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+
+
+#define HID_PLAN_MAX_REPORTS        8       // Input reports tracked per interface
+#define HID_PLAN_MAX_REPORT_BYTES   64      // Fields beyond this offset are dropped (host EP buffer size)
+#define HID_PLAN_MAX_KEY_BITMAPS    2       // Modifier byte plus one NKRO bitmap per report
+#define HID_PLAN_MAX_MULTIPLIERS    2       // Resolution Multiplier feature fields: wheel, then pan
+#define HID_PLAN_MAX_AXES           8       // Gamepad axes X, Y, Z, Rx, Ry, Rz, Slider, Dial
+#define HID_PLAN_MAX_PAD_BUTTONS    32
+
+
+
+
+
+typedef enum {
+    HID_FIELD_BUTTONS = 0,
+    HID_FIELD_X,
+    HID_FIELD_Y,
+    HID_FIELD_WHEEL,
+    HID_FIELD_PAN,
+    HID_FIELD_COUNT
+} hid_field_role_t;
+
+
+typedef struct {
+    uint16_t bit_offset;    // From the start of the report, report ID byte included
+    uint8_t bit_size;       // 0 when the field is absent
+    uint8_t byte_offset;
+    uint8_t bit_shift;
+    uint8_t byte_span;      // Bytes touched by the field (0 when absent)
+    uint8_t sign_shift;     // 32 - bit_size for signed fields, 0 otherwise
+    uint32_t mask;
+    int32_t logical_min;
+    int32_t logical_max;
+    uint16_t usage_page;
+    uint16_t usage;
+} hid_field_t;
+
+// Keyboard page input: a run of 1-bit variable usages, or an array of key slots
+typedef struct {
+    uint16_t bit_offset;    // From the start of the report, report ID byte included
+    uint16_t count;         // Bits in a bitmap run, slots in an array (0 when absent)
+    uint8_t bit_size;       // 1 for bitmaps, slot size for arrays
+    uint8_t usage_first;    // Usage of the first bit, or of logical_min for arrays
+    int32_t logical_min;
+    int32_t logical_max;
+} hid_key_field_t;
+
+typedef struct {
+    uint8_t report_id;      // 0 when the descriptor does not use report IDs
+    uint8_t report_bytes;   // Input report length, report ID byte included
+    bool has_pointer;       // Report carries X/Y or buttons
+    bool has_keyboard;      // Report carries keyboard page usages
+    hid_field_t fields[HID_FIELD_COUNT];
+    hid_key_field_t key_bitmaps[HID_PLAN_MAX_KEY_BITMAPS];
+    hid_key_field_t key_array;
+} hid_report_layout_t;
+
+// Resolution Multiplier: the wheel (or pan) reports this many counts per detent
+// once the host sets the field to logical_max
+typedef struct {
+    hid_field_t field;      // In the feature report, report ID byte included
+    uint8_t report_id;
+    uint8_t report_bytes;   // Feature report length, report ID byte included
+    int32_t physical_min;   // Counts per detent at logical_min
+    int32_t physical_max;   // Counts per detent at logical_max
+} hid_multiplier_t;
+
+// Input report of a Joystick or Gamepad application collection. Its fields are
+// kept out of the pointer layout, so a gamepad is never taken for a mouse.
+typedef struct {
+    bool present;
+    uint8_t report_id;
+    uint8_t report_bytes;   // Report ID byte included
+    hid_field_t axes[HID_PLAN_MAX_AXES];
+    hid_field_t hat;
+    hid_field_t buttons;    // Up to HID_PLAN_MAX_PAD_BUTTONS contiguous 1-bit usages
+} hid_gamepad_layout_t;
+
+typedef struct {
+    hid_report_layout_t reports[HID_PLAN_MAX_REPORTS];
+    uint8_t report_count;
+    bool uses_report_ids;
+    bool has_leds;          // An output report carries LED page usages
+    uint8_t led_report_id;
+    hid_multiplier_t multipliers[HID_PLAN_MAX_MULTIPLIERS];
+    uint8_t multiplier_count;
+    hid_gamepad_layout_t gamepad;
+} hid_report_plan_t;
+
+
+
+
+
+bool hid_parse_report_descriptor(const uint8_t *desc, uint16_t desc_len, hid_report_plan_t *plan);
+
+
+void hid_report_plan_init_boot_mouse(hid_report_plan_t *plan);
+void hid_report_plan_init_boot_keyboard(hid_report_plan_t *plan);
+
+
+bool hid_report_plan_has_pointer(const hid_report_plan_t *plan);
+bool hid_report_plan_has_keyboard(const hid_report_plan_t *plan);
+
+
+const hid_report_layout_t *hid_report_plan_find(const hid_report_plan_t *plan, const uint8_t *report, uint16_t len);
+
+
+static inline int32_t hid_field_extract(const uint8_t *report, const hid_field_t *field)
+{
+    const uint8_t *p = report + field->byte_offset;
+    uint32_t raw = 0;
+    for (uint8_t i = 0; i < field->byte_span; i++) {
+        raw |= (uint32_t)p[i] << (8u * i);
+    }
+    raw = (raw >> field->bit_shift) & field->mask;
+    return (int32_t)(raw << field->sign_shift) >> field->sign_shift;
+}
+
+
+static inline void hid_field_insert(uint8_t *report, const hid_field_t *field, int32_t value)
+{
+    uint8_t *p = report + field->byte_offset;
+    uint32_t const bits = ((uint32_t)value & field->mask) << field->bit_shift;
+    uint32_t const keep = ~(field->mask << field->bit_shift);
+    for (uint8_t i = 0; i < field->byte_span; i++) {
+        p[i] = (uint8_t)((p[i] & (keep >> (8u * i))) | (bits >> (8u * i)));
+    }
+}
+
+
+void hid_field_get_range(const hid_field_t *field, int32_t *min, int32_t *max);
+
+
+// Wheel and pan counts per detent for a multiplier feature report (report ID
+// byte first when the plan uses them); false when the report carries none
+bool hid_multiplier_decode(const hid_report_plan_t *plan, const uint8_t *report, uint16_t len,
+                           uint8_t *wheel, uint8_t *pan);
+
+// Feature report with every multiplier at its highest (or lowest) setting; returns
+// its length, report ID byte included, or 0 when the plan has no multiplier
+uint16_t hid_multiplier_build(const hid_report_plan_t *plan, bool high, uint8_t *report);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // HID_REPORT_PARSER_H
@@ -0,0 +1,89 @@
+/*
+ * Identity Cache
+ * Attached-device identities kept in the last flash sector, keyed by VID/PID, so
+ * the PC-facing side can enumerate as the last device straight from boot
+ */
+
+#ifndef IDENTITY_CACHE_H
+#define IDENTITY_CACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+
+
+
+#define IDENTITY_STRING_MANUFACTURER    0
+#define IDENTITY_STRING_PRODUCT         1
+#define IDENTITY_STRING_SERIAL          2
+#define IDENTITY_STRING_COUNT           3
+#define IDENTITY_STRING_UNITS           32      // String descriptor header plus 31 UTF-16 code units
+#define IDENTITY_REPORT_DESC_MAX        256     // Primary mouse report descriptor
+#define IDENTITY_CACHE_ENTRIES          8       // VID/PID entries in the cache sector
+
+
+
+
+
+// Zero-filled before use so two identities compare with memcmp
+typedef struct {
+    uint16_t vid;
+    uint16_t pid;
+    uint16_t report_desc_len;           // 0 when the built-in mouse descriptor is used
+    uint8_t raw_ok;                     // Host reports match report_desc byte for byte
+    uint8_t mouse_ep_size;              // Device-side endpoints mirrored from the attached
+    uint8_t mouse_ep_interval;          // device; 0 for the defaults
+    uint8_t keyboard_ep_interval;
+    uint8_t reserved[2];
+    uint16_t strings[IDENTITY_STRING_COUNT][IDENTITY_STRING_UNITS];    // Ready to serve; bLength 0 when absent
+    uint8_t report_desc[IDENTITY_REPORT_DESC_MAX];
+} device_identity_t;
+
+typedef struct {
+    uint32_t valid_entries;             // Entries that passed their CRC at boot
+    uint32_t hits;                      // Lookups answered from the cache
+    uint32_t misses;
+    uint32_t writes;                    // Sector rewrites
+    uint32_t write_failures;            // The other core could not be locked out in time
+    uint32_t last_write_us;             // Both cores stalled this long for the last rewrite
+    uint32_t max_write_us;
+} identity_cache_stats_t;
+
+
+
+
+
+void identity_cache_init(void);
+
+
+// Most recently stored identity, or NULL when the sector holds none
+const device_identity_t *identity_cache_last(void);
+const device_identity_t *identity_cache_find(uint16_t vid, uint16_t pid);
+
+
+// Rewrites the sector only when the identity differs from the newest entry.
+// The erase and program run with the other core parked and interrupts off on
+// this one, tens of milliseconds during which neither USB side is serviced, so
+// call it only while nothing is being forwarded.
+bool identity_cache_store(const device_identity_t *identity);
+
+void identity_cache_get_stats(identity_cache_stats_t *stats);
+
+
+// ASCII to a string descriptor, truncated to IDENTITY_STRING_UNITS - 1 characters
+void identity_encode_string(const char *str, uint16_t *desc);
+
+// A string descriptor as read from the device, truncated the same way
+void identity_copy_string(const uint16_t *src, size_t src_bytes, uint16_t *desc);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // IDENTITY_CACHE_H
@@ -1,7 +1,9 @@
 /*
  * KMBox Interface - UART Interface
- * 
+ *
  * Provides a clean interface for KMBox communication over UART.
+ * Received bytes land in a DMA ring and are read in place; responses are
+ * queued in a TX ring that a second DMA channel drains.
  */
 
 #ifndef KMBOX_INTERFACE_H
@@ -18,6 +20,7 @@ typedef enum {
 } kmbox_transport_type_t;
 
 
+// The UART is the one both pins belong to; TX and RX must be a UART pair
 typedef struct {
     uint32_t baudrate;
     unsigned int tx_pin;
@@ -31,28 +34,37 @@ typedef struct {
     union {
         kmbox_uart_config_t uart;
     } config;
-    
-
-    void (*on_command_received)(const uint8_t* data, size_t len);
 } kmbox_interface_config_t;
 
 
 typedef struct {
     uint32_t bytes_received;
-    uint32_t bytes_sent;
-    uint32_t packets_received;
-    uint32_t packets_sent;
-    uint32_t errors;
-    uint32_t commands_processed;
+    uint32_t bytes_sent;            // Handed to the UART by DMA
+    uint32_t rx_irqs;               // DMA re-arms; one per 64 KiB received
+    uint32_t rx_overruns;           // The receiver lapped the reader and the ring was skipped
+    uint32_t rx_bytes_lost;
+    uint32_t uart_overruns;         // Hardware RX FIFO overruns
+    uint32_t tx_dropped_writes;     // Sends dropped whole because the TX ring was full
+    uint32_t tx_dropped_bytes;
+    uint16_t tx_high_water;         // Most bytes ever waiting in the TX ring
 } kmbox_interface_stats_t;
 
 
 bool kmbox_interface_init(const kmbox_interface_config_t* config);
 
 
+// Picks up newly received bytes and keeps the TX DMA going; call every loop
 void kmbox_interface_process(void);
 
 
+// Received bytes from the read position to the newest byte or the end of the
+// ring, whichever comes first. They stay valid until consumed.
+size_t kmbox_interface_rx_peek(const uint8_t** data);
+size_t kmbox_interface_rx_available(void);
+void kmbox_interface_rx_consume(size_t len);
+
+
+// Queues without waiting; false when the TX ring can't take all of it
 bool kmbox_interface_send(const uint8_t* data, size_t len);
 
 
@@ -70,4 +82,4 @@ kmbox_transport_type_t kmbox_interface_get_transport_type(void);
 
 extern const kmbox_uart_config_t KMBOX_UART_DEFAULT_CONFIG;
 
-#endif // KMBOX_INTERFACE_H
\ No newline at end of file
+#endif // KMBOX_INTERFACE_H
@@ -0,0 +1,113 @@
+/*
+ * Mirror Pacing
+ * How reports on the mirrored interfaces share the event queue, the PC-facing
+ * frames and the host bus with pointer traffic. Plain C++, so the host tests
+ * drive the same decisions the firmware makes.
+ */
+
+#ifndef MIRROR_PACING_H
+#define MIRROR_PACING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "defines.h"
+
+
+
+
+
+// What a send callback did with the report at the front of a queue
+typedef enum {
+    MIRROR_SENT = 0,            // On its way; leaves the queue
+    MIRROR_DEFERRED,            // Endpoint busy or out of budget; stays queued
+    MIRROR_DISCARDED            // Interface gone; leaves the queue without using the turn
+} mirror_send_t;
+
+
+// Core 1: whether a report may take an event queue slot at this depth. Mirrored
+// reports stop short of the last headroom slots, which are kept for pointer,
+// key and gamepad events.
+static inline bool mirror_admit(uint32_t depth, bool is_mirrored, uint32_t headroom = HID_MIRROR_EVENT_HEADROOM)
+{
+    return !is_mirrored || depth < HID_EVENT_QUEUE_DEPTH - headroom;
+}
+
+
+// Core 0: mirrored reports to the PC, HID_MIRROR_IN_PER_FRAME a frame after the
+// mouse, queued ones served round-robin across interfaces
+template <uint8_t Slots>
+class mirror_in_pacer {
+public:
+    // Whether one more report fits this frame; spend() once it went out
+    bool may_send() const { return budget_ != 0; }
+    void spend() { budget_--; }
+
+    // From the SOF stage: a new frame's budget, then the queues until it runs out
+    template <typename Queue, typename Send>
+    void flush(Queue *queues, Send send)
+    {
+        budget_ = HID_MIRROR_IN_PER_FRAME;
+
+        uint8_t const start = next_;    // next_ moves as reports go out; the pass does not
+        for (uint8_t n = 0; n < Slots && budget_ != 0; n++) {
+            uint8_t const slot = (uint8_t)((start + n) % Slots);
+            auto const *report = queues[slot].front();
+            if (report == nullptr) {
+                continue;
+            }
+
+            mirror_send_t const result = send(slot, *report);
+            if (result == MIRROR_DEFERRED) {
+                continue;
+            }
+            queues[slot].pop_front();
+            if (result == MIRROR_SENT) {
+                next_ = (uint8_t)((slot + 1) % Slots);
+            }
+        }
+    }
+
+private:
+    uint8_t budget_ = HID_MIRROR_IN_PER_FRAME;     // Left in this frame
+    uint8_t next_ = 0;                              // Round-robin start
+};
+
+
+// Core 1: reports to the attached device, one per HID_MIRROR_OUT_INTERVAL_US
+// across all interfaces, so pointer polling on the host bus keeps its slots
+template <uint8_t Slots>
+class mirror_out_pacer {
+public:
+    template <typename Queue, typename Send>
+    void run(uint32_t now_us, Queue *queues, Send send)
+    {
+        if (now_us - last_us_ < HID_MIRROR_OUT_INTERVAL_US) {
+            return;
+        }
+
+        for (uint8_t n = 0; n < Slots; n++) {
+            uint8_t const slot = (uint8_t)((next_ + n) % Slots);
+            auto const *report = queues[slot].front();
+            if (report == nullptr) {
+                continue;
+            }
+
+            mirror_send_t const result = send(slot, *report);
+            if (result == MIRROR_DEFERRED) {
+                continue;
+            }
+            queues[slot].pop_front();
+            if (result == MIRROR_SENT) {
+                last_us_ = now_us;
+                next_ = (uint8_t)((slot + 1) % Slots);
+                return;
+            }
+        }
+    }
+
+private:
+    uint32_t last_us_ = 0;
+    uint8_t next_ = 0;                              // Round-robin start
+};
+
+#endif // MIRROR_PACING_H
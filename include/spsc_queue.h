@@ -0,0 +1,112 @@
+/*
+ * Single-Producer Single-Consumer Queue
+ * Lock-free ring for handing items from one core to the other
+ */
+
+#ifndef SPSC_QUEUE_H
+#define SPSC_QUEUE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <atomic>
+
+
+
+
+
+// One core pushes, the other pops. Only aligned loads/stores are used on the
+// indices, so this stays lock-free on cores without atomic read-modify-write.
+template <typename T, uint32_t Capacity>
+class spsc_queue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+public:
+    // Producer: fill the returned slot in place, then publish() it
+    T *reserve()
+    {
+        uint32_t const tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) >= Capacity) {
+            drops_++;
+            return nullptr;
+        }
+        return &slots_[tail & (Capacity - 1)];
+    }
+
+    void publish()
+    {
+        uint32_t const tail = tail_.load(std::memory_order_relaxed) + 1;
+        tail_.store(tail, std::memory_order_release);
+
+        uint32_t const depth = tail - head_.load(std::memory_order_acquire);
+        if (depth > high_water_) {
+            high_water_ = depth;
+        }
+        pushed_++;
+    }
+
+    bool push(const T &item)
+    {
+        T *slot = reserve();
+        if (slot == nullptr) {
+            return false;
+        }
+        *slot = item;
+        publish();
+        return true;
+    }
+
+
+    // Consumer: use the oldest slot in place, then pop_front() it
+    T *front()
+    {
+        uint32_t const head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) {
+            return nullptr;
+        }
+        return &slots_[head & (Capacity - 1)];
+    }
+
+    void pop_front()
+    {
+        head_.store(head_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    bool pop(T *item)
+    {
+        T *slot = front();
+        if (slot == nullptr) {
+            return false;
+        }
+        *item = *slot;
+        pop_front();
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+    }
+
+    uint32_t depth() const
+    {
+        return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+    }
+
+
+    uint32_t pushed() const { return pushed_; }
+    uint32_t drops() const { return drops_; }
+    uint32_t high_water() const { return high_water_; }
+    static constexpr uint32_t capacity() { return Capacity; }
+
+private:
+    T slots_[Capacity];
+    std::atomic<uint32_t> head_{0};     // Written by the consumer only
+    std::atomic<uint32_t> tail_{0};     // Written by the producer only
+
+
+    uint32_t pushed_ = 0;
+    uint32_t drops_ = 0;
+    uint32_t high_water_ = 0;
+};
+
+#endif // SPSC_QUEUE_H
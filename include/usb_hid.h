@@ -12,6 +12,7 @@
 #include "class/hid/hid_device.h"
 #include "class/hid/hid_host.h"
 #include "kmbox_serial_handler.h"
+#include "hid_mouse_decoder.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -31,6 +32,205 @@ enum {
 
 
 
+// Relative mouse with 16-bit X/Y so a full delta fits in one report. The wheel and
+// AC Pan share a Resolution Multiplier feature, 8 counts per detent once enabled.
+#define TUD_HID_REPORT_DESC_MOUSE16(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP      ) ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_MOUSE     ) ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION  ) ,\
+    __VA_ARGS__ \
+    HID_USAGE      ( HID_USAGE_DESKTOP_POINTER ) ,\
+    HID_COLLECTION ( HID_COLLECTION_PHYSICAL   ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_BUTTON  ) ,\
+        HID_USAGE_MIN   ( 1                                      ) ,\
+        HID_USAGE_MAX   ( 5                                      ) ,\
+        HID_LOGICAL_MIN ( 0                                      ) ,\
+        HID_LOGICAL_MAX ( 1                                      ) ,\
+        HID_REPORT_COUNT( 5                                      ) ,\
+        HID_REPORT_SIZE ( 1                                      ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_REPORT_COUNT( 1                                      ) ,\
+        HID_REPORT_SIZE ( 3                                      ) ,\
+        HID_INPUT       ( HID_CONSTANT                           ) ,\
+      HID_USAGE_PAGE  ( HID_USAGE_PAGE_DESKTOP ) ,\
+        HID_USAGE         ( HID_USAGE_DESKTOP_X                    ) ,\
+        HID_USAGE         ( HID_USAGE_DESKTOP_Y                    ) ,\
+        HID_LOGICAL_MIN_N ( -32767, 2                              ) ,\
+        HID_LOGICAL_MAX_N ( 32767, 2                               ) ,\
+        HID_REPORT_COUNT  ( 2                                      ) ,\
+        HID_REPORT_SIZE   ( 16                                     ) ,\
+        HID_INPUT         ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_COLLECTION ( HID_COLLECTION_LOGICAL  ) ,\
+        HID_USAGE        ( HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER ) ,\
+        HID_LOGICAL_MIN  ( 0                                      ) ,\
+        HID_LOGICAL_MAX  ( 1                                      ) ,\
+        HID_PHYSICAL_MIN ( 1                                      ) ,\
+        HID_PHYSICAL_MAX ( 8                                      ) ,\
+        HID_REPORT_COUNT ( 1                                      ) ,\
+        HID_REPORT_SIZE  ( 8                                      ) ,\
+        HID_FEATURE      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+        HID_PHYSICAL_MIN ( 0                                      ) ,\
+        HID_PHYSICAL_MAX ( 0                                      ) ,\
+        HID_USAGE       ( HID_USAGE_DESKTOP_WHEEL                ) ,\
+        HID_LOGICAL_MIN ( 0x81                                   ) ,\
+        HID_LOGICAL_MAX ( 0x7f                                   ) ,\
+        HID_REPORT_COUNT( 1                                      ) ,\
+        HID_REPORT_SIZE ( 8                                      ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+        HID_USAGE_PAGE  ( HID_USAGE_PAGE_CONSUMER ) ,\
+        HID_USAGE_N     ( HID_USAGE_CONSUMER_AC_PAN, 2           ) ,\
+        HID_LOGICAL_MIN ( 0x81                                   ) ,\
+        HID_LOGICAL_MAX ( 0x7f                                   ) ,\
+        HID_REPORT_COUNT( 1                                      ) ,\
+        HID_REPORT_SIZE ( 8                                      ) ,\
+        HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_RELATIVE ) ,\
+      HID_COLLECTION_END ,\
+    HID_COLLECTION_END ,\
+  HID_COLLECTION_END
+
+// NKRO keyboard: modifier byte, reserved byte, then one bit per usage 00-DF
+#define TUD_HID_REPORT_DESC_KEYBOARD_NKRO(...) \
+  HID_USAGE_PAGE ( HID_USAGE_PAGE_DESKTOP     ) ,\
+  HID_USAGE      ( HID_USAGE_DESKTOP_KEYBOARD ) ,\
+  HID_COLLECTION ( HID_COLLECTION_APPLICATION ) ,\
+    __VA_ARGS__ \
+    HID_USAGE_PAGE  ( HID_USAGE_PAGE_KEYBOARD                ) ,\
+      HID_USAGE_MIN   ( 224                                    ) ,\
+      HID_USAGE_MAX   ( 231                                    ) ,\
+      HID_LOGICAL_MIN ( 0                                      ) ,\
+      HID_LOGICAL_MAX ( 1                                      ) ,\
+      HID_REPORT_COUNT( 8                                      ) ,\
+      HID_REPORT_SIZE ( 1                                      ) ,\
+      HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+      HID_REPORT_COUNT( 1                                      ) ,\
+      HID_REPORT_SIZE ( 8                                      ) ,\
+      HID_INPUT       ( HID_CONSTANT                           ) ,\
+    HID_USAGE_PAGE  ( HID_USAGE_PAGE_LED                     ) ,\
+      HID_USAGE_MIN   ( 1                                      ) ,\
+      HID_USAGE_MAX   ( 5                                      ) ,\
+      HID_REPORT_COUNT( 5                                      ) ,\
+      HID_REPORT_SIZE ( 1                                      ) ,\
+      HID_OUTPUT      ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+      HID_REPORT_COUNT( 1                                      ) ,\
+      HID_REPORT_SIZE ( 3                                      ) ,\
+      HID_OUTPUT      ( HID_CONSTANT                           ) ,\
+    HID_USAGE_PAGE  ( HID_USAGE_PAGE_KEYBOARD                ) ,\
+      HID_USAGE_MIN   ( 0                                      ) ,\
+      HID_USAGE_MAX   ( 223                                    ) ,\
+      HID_LOGICAL_MIN ( 0                                      ) ,\
+      HID_LOGICAL_MAX ( 1                                      ) ,\
+      HID_REPORT_COUNT( 224                                    ) ,\
+      HID_REPORT_SIZE ( 1                                      ) ,\
+      HID_INPUT       ( HID_DATA | HID_VARIABLE | HID_ABSOLUTE ) ,\
+  HID_COLLECTION_END
+
+
+
+
+
+
+typedef struct {
+  uint32_t pushed;        // Events queued by core 1
+  uint32_t popped;        // Events handled on core 0
+  uint32_t drops;         // Events lost to a full queue
+  uint32_t depth;         // Events currently queued
+  uint32_t high_water;    // Deepest the queue has been
+  uint32_t doorbells;     // Doorbell words received over the multicore FIFO (wake hints only)
+} hid_event_stats_t;
+
+typedef struct {
+  uint32_t frames;        // SOFs seen by the output stage
+  uint32_t reports;       // Coalesced reports submitted
+  uint32_t merged_inputs; // Physical reports folded into those reports
+  uint32_t report_rate;   // Reports per second over the last measurement window
+} hid_frame_stats_t;
+
+typedef struct {
+  uint32_t endpoint_busy; // Flushes deferred with input waiting behind a report still in flight
+  uint32_t send_failures; // Reports the device stack refused; nothing was consumed
+  uint32_t committed;     // Reports the PC acknowledged
+  uint32_t aborted;       // In-flight reports dropped by a bus reset; motion retained
+  int64_t fed_x;          // Running sum of X taken into kmbox: physical after the axis locks, plus injected
+  int64_t fed_y;
+  int64_t committed_x;    // Running sum of X acknowledged by the PC
+  int64_t committed_y;
+  int32_t pending_x;      // Still accumulated; fed = committed + pending when no motion was lost
+  int32_t pending_y;
+} hid_backpressure_stats_t;
+
+typedef struct {
+  uint32_t raw;           // Host reports forwarded byte for byte
+  uint32_t patched;       // Host reports forwarded with buttons/X/Y/wheel rewritten in place
+  uint32_t merged;        // Pointer reports left to the SOF stage because the endpoint was busy
+  uint32_t dropped;       // Non-pointer reports lost to a busy endpoint
+  uint32_t mirrored;      // Reports forwarded on the attached device's other interfaces
+} hid_passthrough_stats_t;
+
+typedef struct {
+  uint32_t mounts;                // Host HID interfaces mounted
+  uint32_t first_reports;         // Of those, how many have delivered a report
+  uint32_t last_first_report_us;  // Mount to first report, most recent interface
+  uint32_t max_first_report_us;   // Mount to first report, slowest interface
+  uint32_t strings_fetched;       // String sets completed in the background
+  uint32_t string_failures;       // String requests that failed; fallbacks were used
+  uint32_t last_strings_us;       // Mount to complete strings, most recent device
+} hid_enumeration_stats_t;
+
+typedef struct {
+  uint32_t queued;        // SET_REPORT/GET_REPORT requests queued for the attached device
+  uint32_t forwarded;     // Transfers the attached device completed
+  uint32_t failed;        // Transfers the attached device stalled or failed
+  uint32_t dropped;       // Lost to a full queue
+  uint32_t orphaned;      // Target interface went away before or during the transfer
+  uint32_t timeouts;      // Aborted after HID_REQUEST_TIMEOUT_MS without a completion
+  uint32_t get_answered;  // GET_REPORT answered with the attached device's own reply
+  uint32_t get_stalled;   // GET_REPORT stalled: the device failed or timed out, or the queue was full
+} hid_forward_stats_t;
+
+typedef struct {
+  uint32_t in_reports;    // Attached device to PC on the mirrored interfaces
+  uint32_t in_bytes;
+  uint32_t in_queued;     // Waited for a busy endpoint or the next frame's budget
+  uint32_t in_dropped;    // Per-interface queue full
+  uint32_t in_throttled;  // Not posted, to keep event queue room for pointer and key events
+  uint32_t in_unrouted;   // Keyboard-interface reports that were neither keys nor mirrored
+  uint32_t out_reports;   // PC to attached device over the interrupt OUT endpoint
+  uint32_t out_bytes;
+  uint32_t out_dropped;   // Per-interface queue full
+  uint32_t out_orphaned;  // Interface went away before the report was sent
+  uint32_t out_deferred;  // Passes that found the attached device's OUT endpoint busy
+} hid_mirror_stats_t;
+
+typedef struct {
+  uint32_t overridden;    // Interrupt IN endpoints polled faster than their bInterval
+  uint8_t advertised_ms;  // Most recent override: what the device asked for
+  uint8_t applied_ms;     // and what the host polls it at
+  uint32_t mouse_rate;    // Reports per second from attached mice, last measurement window
+  uint32_t input_rate;    // Reports per second from every attached interface
+} hid_poll_stats_t;
+
+typedef enum {
+  HID_LATENCY_MOUSE = 0,
+  HID_LATENCY_KEYBOARD,
+  HID_LATENCY_GAMEPAD,
+  HID_LATENCY_OTHER,      // Other mirrored interfaces
+  HID_LATENCY_CLASS_COUNT
+} hid_latency_class_t;
+
+// Host report received on core 1 to the report armed on the PC-facing endpoint
+typedef struct {
+  uint32_t reports;
+  uint32_t last_us;
+  uint32_t max_us;
+  uint64_t total_us;      // Divide by reports for the mean
+} hid_latency_class_stats_t;
+
+typedef struct {
+  hid_latency_class_stats_t classes[HID_LATENCY_CLASS_COUNT];
+} hid_latency_stats_t;
+
+
+
 
 
 
@@ -38,11 +238,29 @@ void hid_device_task(void);
 void send_hid_report(uint8_t report_id);
 
 
+void hid_event_task(void);
+void usb_hid_get_event_stats(hid_event_stats_t *stats);
+void usb_hid_get_frame_stats(hid_frame_stats_t *stats);
+void usb_hid_get_backpressure_stats(hid_backpressure_stats_t *stats);
+void usb_hid_get_passthrough_stats(hid_passthrough_stats_t *stats);
+void usb_hid_get_enumeration_stats(hid_enumeration_stats_t *stats);
+void usb_hid_get_forward_stats(hid_forward_stats_t *stats);
+void usb_hid_get_mirror_stats(hid_mirror_stats_t *stats);
+void usb_hid_get_latency_stats(hid_latency_stats_t *stats);
+void usb_hid_get_poll_stats(hid_poll_stats_t *stats);
+
+
 void hid_host_task(void);
 
 
 void process_kbd_report(hid_keyboard_report_t const *report);
-void process_mouse_report(hid_mouse_report_t const *report);
+void process_mouse_report(hid_mouse_sample_t const *report);
+
+
+bool usb_hid_send_mouse_report(uint16_t buttons, int16_t x, int16_t y, int16_t wheel, int16_t pan);
+bool usb_hid_flush_mouse_report(void);
+bool usb_hid_flush_keyboard_report(void);
+void usb_hid_set_injected_key(uint8_t usage, bool pressed);
 
 
 bool find_key_in_report(hid_keyboard_report_t const *report, uint8_t keycode);
@@ -52,6 +270,7 @@ bool usb_hid_init(void);
 bool usb_host_enable_power(void);
 bool get_caps_lock_state(void);
 bool is_mouse_connected(void);
+bool is_keyboard_connected(void);
 
 
 void usb_device_mark_initialized(void);
@@ -74,9 +293,6 @@ extern uint8_t const desc_hid_report[];
 extern tusb_desc_device_t const desc_device;
 
 
-extern uint8_t const desc_configuration[];
-
-
 extern char const* string_desc_arr[];
 
 
@@ -88,8 +304,10 @@ void tud_mount_cb(void);
 void tud_umount_cb(void);
 void tud_suspend_cb(bool remote_wakeup_en);
 void tud_resume_cb(void);
+void tud_sof_cb(uint32_t frame_count);
 
 
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate);
 uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t* buffer, uint16_t reqlen);
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t const* buffer, uint16_t bufsize);
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len);
@@ -112,6 +330,7 @@ const char* get_dynamic_serial_string(void);
 
 
 void force_usb_reenumeration(void);
+void request_usb_reenumeration(void);
 
 
 void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_report, uint16_t desc_len);
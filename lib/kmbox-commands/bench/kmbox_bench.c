@@ -0,0 +1,104 @@
+/*
+ * KMBox Command Dispatch Benchmark
+ * Host-side throughput of kmbox_process_serial_line over a mix of commands
+ * shaped like aim-assist and macro traffic: mostly relative moves, some button
+ * and wheel commands, and the occasional query
+ */
+
+#include "kmbox_commands.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+
+#define BENCH_DEFAULT_ITERATIONS 2000000u
+
+
+#ifdef KMBOX_BENCH_DISCARD_OUTPUT
+// Replaces the stdout writer, leaving the dispatch cost on its own
+static void discard_output(const uint8_t *data, size_t len)
+{
+    (void)data;
+    (void)len;
+}
+#endif
+
+
+typedef struct {
+    const char *line;
+    unsigned weight;            // Occurrences per pass over the mix
+} bench_command_t;
+
+static const bench_command_t bench_mix[] = {
+    { "km.move(3,-2)",      40 },
+    { "km.move(-127,64)",   10 },
+    { "m(1,1)",             10 },
+    { "km.left(1)",          4 },
+    { "km.left(0)",          4 },
+    { "km.right(1)",         1 },
+    { "km.right(0)",         1 },
+    { "km.wheel(-1)",        3 },
+    { "km.click(0)",         2 },
+    { "km.side1()",          1 },
+    { "km.lock_mx(1)",       1 },
+    { "km.lock_mx(0)",       1 },
+    { "km.buttons()",        1 },
+    { "km.catch_xy(50)",     1 },
+};
+
+
+static double now_seconds(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long iterations = argc > 1 ? strtoul(argv[1], NULL, 10) : BENCH_DEFAULT_ITERATIONS;
+
+
+    // Responses go to a large buffer on /dev/null, so the echo costs formatting only
+    static char sink[1 << 16];
+    if (freopen("/dev/null", "w", stdout) == NULL) {
+        return 1;
+    }
+    setvbuf(stdout, sink, _IOFBF, sizeof(sink));
+
+    const char *lines[256];
+    size_t lengths[256];
+    unsigned count = 0;
+    for (size_t i = 0; i < sizeof(bench_mix) / sizeof(bench_mix[0]); i++) {
+        for (unsigned w = 0; w < bench_mix[i].weight && count < 256; w++) {
+            lines[count] = bench_mix[i].line;
+            lengths[count] = strlen(bench_mix[i].line);
+            count++;
+        }
+    }
+
+    kmbox_commands_init();
+#ifdef KMBOX_BENCH_DISCARD_OUTPUT
+    kmbox_set_output(discard_output);
+#endif
+
+    uint8_t buttons;
+    int16_t x, y, wheel, pan;
+    uint32_t now_ms = 0;
+    double const start = now_seconds();
+    for (unsigned long i = 0; i < iterations; i++) {
+        unsigned const n = (unsigned)((i * 37u) % count);     // Interleave the mix
+        kmbox_process_serial_line(lines[n], lengths[n], "\r\n", 2, now_ms);
+        if ((i & 7u) == 7u) {
+            now_ms++;
+            kmbox_update_states(now_ms);
+            kmbox_get_mouse_report(&buttons, &x, &y, &wheel, &pan);
+        }
+    }
+    double const elapsed = now_seconds() - start;
+
+    fprintf(stderr, "%lu commands in %.3f s: %.0f commands/s (%.1f ns each)\n",
+            iterations, elapsed, (double)iterations / elapsed, elapsed * 1e9 / (double)iterations);
+    return 0;
+}
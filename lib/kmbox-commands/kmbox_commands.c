@@ -19,6 +19,10 @@
 #define CLICK_PRESS_MAX_TIME_MS 125
 
 
+#define KMBOX_DEFAULT_MOVE_LIMIT 32767
+#define KMBOX_DEFAULT_WHEEL_LIMIT 127
+
+
 static const char* button_names[KMBOX_BUTTON_COUNT] = {
     "left",
     "right", 
@@ -31,20 +35,50 @@ static const char* button_names[KMBOX_BUTTON_COUNT] = {
 
 
 
-static const char* lock_button_names[KMBOX_BUTTON_COUNT] = {
-    "ml",    // Left button
-    "mr",    // Right button
-    "mm",    // Middle button
-    "ms1",   // Side button 1
-    "ms2"    // Side button 2
-};
+static kmbox_state_t g_kmbox_state; // zero-initialized by default (static storage)
+static kmbox_parser_t g_parser;     // zero-initialized by default (static storage)
 
 
+// Every response leaves through here; without a hook it goes to stdout
+#define KMBOX_PROMPT ">>> "
+#define KMBOX_PROMPT_LEN 4
 
+static kmbox_output_fn g_output = NULL;
 
+static void emit(const void* data, size_t len)
+{
+    if (g_output) {
+        g_output((const uint8_t*)data, len);
+    } else {
+        fwrite(data, 1, len, stdout);
+    }
+}
 
-static kmbox_state_t g_kmbox_state; // zero-initialized by default (static storage)
-static kmbox_parser_t g_parser;     // zero-initialized by default (static storage)
+// Decimal digits for a reply, without going through printf
+static size_t format_uint(char* out, uint32_t value)
+{
+    char digits[10];
+    size_t count = 0;
+    do {
+        digits[count++] = (char)('0' + value % 10u);
+        value /= 10u;
+    } while (value != 0);
+
+    size_t len = 0;
+    while (count > 0) {
+        out[len++] = digits[--count];
+    }
+    return len;
+}
+
+static size_t format_int(char* out, int32_t value)
+{
+    if (value < 0) {
+        out[0] = '-';
+        return 1 + format_uint(&out[1], 0u - (uint32_t)value);
+    }
+    return format_uint(out, (uint32_t)value);
+}
 
 
 
@@ -53,8 +87,8 @@ static kmbox_parser_t g_parser;     // zero-initialized by default (static stora
 
 
 typedef struct {
-    int16_t dx;
-    int16_t dy;
+    int32_t dx;
+    int32_t dy;
     uint32_t t_ms;
 } movement_event_t;
 
@@ -65,7 +99,7 @@ static movement_event_t g_mov_history[KMBOX_MOV_HISTORY_SIZE];
 static uint16_t g_mov_head = 0;   // Next write position
 static uint16_t g_mov_count = 0;  // Number of valid entries
 
-static void record_movement_event(int16_t dx, int16_t dy, uint32_t now_ms)
+static void record_movement_event(int32_t dx, int32_t dy, uint32_t now_ms)
 {
 
     if (dx == 0 && dy == 0) return;
@@ -137,24 +171,19 @@ static uint32_t get_random_click_press_time(void)
 
 
 
-static kmbox_button_t parse_button_name(const char* name)
+static uint8_t current_button_byte(void)
 {
-    for (int i = 0; i < KMBOX_BUTTON_COUNT; i++) {
-        if (strcmp(name, button_names[i]) == 0) {
-            return (kmbox_button_t)i;
-        }
-    }
-    return KMBOX_BUTTON_COUNT; // Invalid button
+    return (g_kmbox_state.buttons[KMBOX_BUTTON_LEFT].is_pressed   ? 0x01 : 0) |
+           (g_kmbox_state.buttons[KMBOX_BUTTON_RIGHT].is_pressed  ? 0x02 : 0) |
+           (g_kmbox_state.buttons[KMBOX_BUTTON_MIDDLE].is_pressed ? 0x04 : 0) |
+           (g_kmbox_state.buttons[KMBOX_BUTTON_SIDE1].is_pressed  ? 0x08 : 0) |
+           (g_kmbox_state.buttons[KMBOX_BUTTON_SIDE2].is_pressed  ? 0x10 : 0);
 }
 
-static kmbox_button_t parse_lock_button_name(const char* name)
+
+static void latch_button_presses(void)
 {
-    for (int i = 0; i < KMBOX_BUTTON_COUNT; i++) {
-        if (strcmp(name, lock_button_names[i]) == 0) {
-            return (kmbox_button_t)i;
-        }
-    }
-    return KMBOX_BUTTON_COUNT; // Invalid button
+    g_kmbox_state.press_latch |= (uint8_t)(current_button_byte() & ~g_kmbox_state.committed_buttons);
 }
 
 static void set_button_state(kmbox_button_t button, bool pressed, uint32_t current_time_ms)
@@ -171,6 +200,7 @@ static void set_button_state(kmbox_button_t button, bool pressed, uint32_t curre
         btn_state->is_forced = true;
         btn_state->release_time = 0; // Indefinite press
         btn_state->is_clicking = false; // Cancel any ongoing click
+        latch_button_presses();
     } else {
 
         if (btn_state->is_forced && btn_state->is_pressed) {
@@ -201,6 +231,7 @@ static void start_button_click(kmbox_button_t button, uint32_t current_time_ms)
     btn_state->click_release_start = current_time_ms + press_duration;
     btn_state->click_end_time = btn_state->click_release_start + release_duration;
     btn_state->release_time = 0; // Not used during click
+    latch_button_presses();
 }
 
 static void set_button_lock(kmbox_button_t button, bool locked)
@@ -227,423 +258,612 @@ static bool get_button_lock(kmbox_button_t button)
 
 static void send_button_state_callback(uint8_t button_state)
 {
-
-
-    printf("km.%c\r\n>>> ", button_state);
+    char const report[] = { 'k', 'm', '.', (char)button_state, '\r', '\n', '>', '>', '>', ' ' };
+    emit(report, sizeof(report));
 }
 
 
 
 
 
-static void parse_command(const char* cmd, uint32_t current_time_ms)
-{
-
-
-
-
-
-
-
-
-
-
-
+// Commands are looked up by verb through a switch on (first byte, last byte,
+// length), which is unique across the table, so a command costs one jump and
+// one memcmp however many verbs come before it. Arguments are parsed once,
+// against the command's schema, before the handler runs.
+#define KMBOX_VERB_MAX 8
+#define KMBOX_BATCH_MAX 8               // Commands in one ';' batch
+#define VERB_KEY(first, last, len) (((uint32_t)(uint8_t)(first) << 16) | ((uint32_t)(uint8_t)(last) << 8) | (uint32_t)(len))
+
+typedef enum {
+    ARG_INT = 0,        // Any integer, saturated to int32
+    ARG_STATE,          // 0 or 1
+    ARG_BUTTON,         // Mouse button index
+    ARG_PAD_AXIS,
+    ARG_PAD_BUTTON,
+    ARG_PAD_HAT,
+    ARG_STAT,           // km.stats counter index
+    ARG_KIND_COUNT
+} arg_kind_t;
+
+static const struct {
+    int32_t min;
+    int32_t max;
+} arg_ranges[ARG_KIND_COUNT] = {
+    [ARG_INT]        = { INT32_MIN, INT32_MAX },
+    [ARG_STATE]      = { 0, 1 },
+    [ARG_BUTTON]     = { 0, KMBOX_BUTTON_COUNT - 1 },
+    [ARG_PAD_AXIS]   = { 0, KMBOX_PAD_AXES - 1 },
+    [ARG_PAD_BUTTON] = { 0, KMBOX_PAD_BUTTONS - 1 },
+    [ARG_PAD_HAT]    = { KMBOX_PAD_HAT_RELEASED, KMBOX_PAD_HAT_CENTER },
+    [ARG_STAT]       = { 0, KMBOX_STATS_MAX - 1 },
+};
 
+typedef struct {
+    uint8_t count;                  // 0 for "()"
+    int32_t values[KMBOX_FRAME_MAX_ARGS];
+} command_args_t;
 
+typedef void (*command_handler_t)(const command_args_t* args, uint8_t param, uint32_t current_time_ms);
 
+typedef struct {
+    char verb[KMBOX_VERB_MAX + 1];
+    uint8_t min_args;
+    uint8_t max_args;
+    uint8_t kinds[KMBOX_FRAME_MAX_ARGS];
+    uint8_t param;                  // Button index for verbs sharing a handler
+    bool quiet;                     // Answered without echoing the command first
+    command_handler_t handler;
+} command_entry_t;
 
 
-    bool is_km = (strncmp(cmd, "km.", 3) == 0);
-    bool is_alias_move = (cmd[0] == 'm' && cmd[1] == '(');
-    if (!is_km && !is_alias_move) {
-        return;
+static bool check_args(const command_entry_t* entry, const command_args_t* args)
+{
+    if (args->count < entry->min_args || args->count > entry->max_args) {
+        return false;
     }
-
-
-    if (strncmp(cmd + 3, "catch_xy(", 9) == 0) {
-        const char* num_start = cmd + 12; // Skip "km.catch_xy("
-        char* num_end;
-        long duration = strtol(num_start, &num_end, 10);
-
-        if (*num_end != ')') {
-            return;
+    for (uint8_t i = 0; i < args->count; i++) {
+        uint8_t const kind = entry->kinds[i];
+        if (args->values[i] < arg_ranges[kind].min || args->values[i] > arg_ranges[kind].max) {
+            return false;
         }
-        if (duration < 0) duration = 0;
-        if (duration > 1000) duration = 1000;
-
-        uint32_t now = current_time_ms;
-        uint32_t since = now - (uint32_t)duration;
-        int32_t sx = 0, sy = 0;
-        sum_movement_since(since, now, &sx, &sy);
-
-
-        printf("(%ld, %ld)\r\n>>> ", (long)sx, (long)sy);
-        return;
     }
+    return true;
+}
 
+// Signed decimal integers separated by commas, whitespace allowed around each.
+// Text after the first keep values is ignored, as the text protocol always has:
+// km.move(1,2,3) moves by (1,2).
+static bool parse_args(const char* p, const char* end, uint8_t keep, command_args_t* args)
+{
+    args->count = 0;
+    while (p < end && isspace((unsigned char)*p)) p++;
+    if (p == end) {
+        return true;
+    }
 
-    printf("%s%.*s", cmd, g_parser.terminator_len, g_parser.command_terminator);
-    
-
-    if ((is_km && strncmp(cmd + 3, "move(", 5) == 0) || is_alias_move) {
-
-        const char* args_start = is_alias_move ? (cmd + 2) : (cmd + 8); // Skip "m(" or "km.move("
-        const char* comma_pos = strchr(args_start, ',');
-        if (!comma_pos) {
-            return;
+    for (;;) {
+        if (args->count == keep) {
+            return true;
         }
-        
 
-        char x_str[16];
-        size_t x_len = comma_pos - args_start;
-        if (x_len >= sizeof(x_str)) {
-            return;
+        bool negative = false;
+        if (*p == '-' || *p == '+') {
+            negative = (*p == '-');
+            p++;
+        }
+        if (p == end || !isdigit((unsigned char)*p)) {
+            return false;
         }
-        strncpy(x_str, args_start, x_len);
-        x_str[x_len] = '\0';
-
 
-        {
-            const char *p = x_str;
-            while (*p && isspace((unsigned char)*p)) p++;
-            if (*p == '\0') {
-                return; // x missing; require explicit 0 per spec
+        int64_t value = 0;
+        while (p < end && isdigit((unsigned char)*p)) {
+            if (value <= INT32_MAX) {
+                value = value * 10 + (*p - '0');
             }
+            p++;
         }
-        
-
-        const char* y_start = comma_pos + 1;
-        while (*y_start && isspace((unsigned char)*y_start)) {
-            y_start++;
+        if (negative) {
+            value = -value;
         }
-        
+        if (value > INT32_MAX) value = INT32_MAX;
+        if (value < INT32_MIN) value = INT32_MIN;
+        args->values[args->count++] = (int32_t)value;
 
-        const char* paren_end = strchr(y_start, ')');
-        if (!paren_end) {
-            return;
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end) {
+            return true;
         }
-        
-
-        char y_str[16];
-        size_t y_len = paren_end - y_start;
-        if (y_len >= sizeof(y_str)) {
-            return;
+        if (*p++ != ',') {
+            return false;
         }
-        strncpy(y_str, y_start, y_len);
-        y_str[y_len] = '\0';
+        while (p < end && isspace((unsigned char)*p)) p++;
+    }
+}
 
 
-        {
-            const char *p = y_str;
-            while (*p && isspace((unsigned char)*p)) p++;
-            if (*p == '\0') {
-                return; // y missing; require explicit 0 per spec
-            }
+// Replies go out as text, or as a frame when the command came in as one; a
+// binary command that only acts gets no reply at all
+static bool g_reply_binary = false;
+static bool g_reply_batch = false;      // One prompt after the whole batch instead
+static uint8_t g_reply_opcode = 0;
+static kmbox_frame_stats_t g_frame_stats;
+
+static uint8_t crc8(const uint8_t* data, size_t len)
+{
+    uint8_t crc = 0;
+    while (len--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (uint8_t)((crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1);
         }
-        
+    }
+    return crc;
+}
 
-        int x_amount = atoi(x_str);
-        int y_amount = atoi(y_str);
-        
+static void send_frame(uint8_t opcode, const int32_t* values, uint8_t count)
+{
+    uint8_t frame[KMBOX_FRAME_MAX];
+    size_t len = 0;
+    frame[len++] = KMBOX_FRAME_SYNC;
+    frame[len++] = (uint8_t)(opcode | (count << KMBOX_FRAME_ARGC_SHIFT));
+    for (uint8_t i = 0; i < count; i++) {
+        uint32_t zigzag = ((uint32_t)values[i] << 1) ^ (uint32_t)(values[i] >> 31);
+        while (zigzag >= 0x80) {
+            frame[len++] = (uint8_t)(zigzag | 0x80);
+            zigzag >>= 7;
+        }
+        frame[len++] = (uint8_t)zigzag;
+    }
+    frame[len] = crc8(&frame[1], len - 1);
+    len++;
 
-        kmbox_add_mouse_movement(x_amount, y_amount);
-        
+    emit(frame, len);
+}
 
-        printf(">>> ");
+static void reply_ok(void)
+{
+    if (!g_reply_binary && !g_reply_batch) {
+        emit(KMBOX_PROMPT, KMBOX_PROMPT_LEN);
+    }
+}
+
+static void reply_values(const int32_t* values, uint8_t count)
+{
+    if (g_reply_binary) {
+        send_frame(g_reply_opcode, values, count);
         return;
     }
-    
 
-    if (strncmp(cmd + 3, "wheel(", 6) == 0) {
+    char text[32];      // "(-2147483648, -2147483648)\r\n>>> "
+    size_t len = 0;
+    if (count == 1) {
+        len = format_int(text, values[0]);
+    } else {
+        text[len++] = '(';
+        len += format_int(&text[len], values[0]);
+        text[len++] = ',';
+        text[len++] = ' ';
+        len += format_int(&text[len], values[1]);
+        text[len++] = ')';
+    }
+    text[len++] = '\r';
+    text[len++] = '\n';
+    if (!g_reply_batch) {
+        memcpy(&text[len], KMBOX_PROMPT, KMBOX_PROMPT_LEN);
+        len += KMBOX_PROMPT_LEN;
+    }
+    emit(text, len);
+}
 
-        const char* num_start = cmd + 9; // Skip "km.wheel("
-        char* num_end;
-        long wheel_amount = strtol(num_start, &num_end, 10);
-        
+static void reply_state(bool state)
+{
+    int32_t const value = state ? 1 : 0;
+    reply_values(&value, 1);
+}
 
-        if (*num_end != ')') {
-            return;
-        }
-        
 
-        kmbox_add_wheel_movement((int8_t)wheel_amount);
-        
+static void cmd_catch_xy(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    int32_t duration = args->values[0];
+    if (duration < 0) duration = 0;
+    if (duration > 1000) duration = 1000;
 
-        printf(">>> ");
-        return;
-    }
-    
+    uint32_t since = current_time_ms - (uint32_t)duration;
+    int32_t sx = 0, sy = 0;
+    sum_movement_since(since, current_time_ms, &sx, &sy);
 
-    if (strncmp(cmd + 3, "lock_mx(", 8) == 0) {
+    int32_t const sums[2] = { sx, sy };
+    reply_values(sums, 2);
+}
 
-        const char* arg_start = cmd + 11; // Skip "km.lock_mx("
-        const char* paren_end = strchr(arg_start, ')');
-        
-        if (!paren_end) {
-            return;
-        }
-        
+static void cmd_move(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    kmbox_add_mouse_movement(args->values[0], args->values[1]);
+    reply_ok();
+}
 
-        size_t arg_len = paren_end - arg_start;
-        if (arg_len == 0) {
+static void cmd_wheel(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    kmbox_add_wheel_movement(args->values[0]);
+    reply_ok();
+}
 
-            printf("%d\r\n>>> ", g_kmbox_state.lock_mx ? 1 : 0);
-            return;
-        }
-        
+static void cmd_pan(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    kmbox_add_pan_movement(args->values[0]);
+    reply_ok();
+}
 
-        char state_str[8];
-        if (arg_len >= sizeof(state_str)) {
-            return;
-        }
-        
-        strncpy(state_str, arg_start, arg_len);
-        state_str[arg_len] = '\0';
-        
+static void cmd_axis(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    kmbox_gamepad_t* pad = &g_kmbox_state.gamepad;
+    uint8_t const bit = (uint8_t)(1u << args->values[0]);
 
-        int state = atoi(state_str);
-        if (state != 0 && state != 1) {
-            return; // Invalid state
-        }
-        
+    if (args->count == 1) {
+        pad->axis_mask &= (uint8_t)~bit;    // Back to the gamepad's own axis
+    } else {
+        int32_t value = args->values[1];
+        if (value < -KMBOX_PAD_AXIS_MAX) value = -KMBOX_PAD_AXIS_MAX;
+        if (value > KMBOX_PAD_AXIS_MAX) value = KMBOX_PAD_AXIS_MAX;
+        pad->axes[args->values[0]] = (int16_t)value;
+        pad->axis_mask |= bit;
+    }
+    pad->sequence++;
+    reply_ok();
+}
 
-        g_kmbox_state.lock_mx = (state == 1);
-        
+static void cmd_pad(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    kmbox_gamepad_t* pad = &g_kmbox_state.gamepad;
+    uint32_t const bit = 1u << args->values[0];
 
-        printf(">>> ");
+    if (args->count == 1) {
+        reply_state((pad->buttons & bit) != 0);
         return;
     }
-    
-
-    if (strncmp(cmd + 3, "lock_my(", 8) == 0) {
-
-        const char* arg_start = cmd + 11; // Skip "km.lock_my("
-        const char* paren_end = strchr(arg_start, ')');
-        
-        if (!paren_end) {
-            return;
-        }
-        
-
-        size_t arg_len = paren_end - arg_start;
-        if (arg_len == 0) {
-
-            printf("%d\r\n>>> ", g_kmbox_state.lock_my ? 1 : 0);
-            return;
-        }
-        
+    if (args->values[1] == 1) {
+        pad->buttons |= bit;
+    } else {
+        pad->buttons &= ~bit;
+    }
+    pad->sequence++;
+    reply_ok();
+}
 
-        char state_str[8];
-        if (arg_len >= sizeof(state_str)) {
-            return;
-        }
-        
-        strncpy(state_str, arg_start, arg_len);
-        state_str[arg_len] = '\0';
-        
+static void cmd_hat(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    g_kmbox_state.gamepad.hat = (int8_t)args->values[0];
+    g_kmbox_state.gamepad.sequence++;
+    reply_ok();
+}
 
-        int state = atoi(state_str);
-        if (state != 0 && state != 1) {
-            return; // Invalid state
-        }
-        
+// param: 0 for X, 1 for Y
+static void cmd_lock_axis(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)current_time_ms;
+    bool* lock = param ? &g_kmbox_state.lock_my : &g_kmbox_state.lock_mx;
+    if (args->count == 0) {
+        reply_state(*lock);
+        return;
+    }
+    *lock = (args->values[0] == 1);
+    reply_ok();
+}
 
-        g_kmbox_state.lock_my = (state == 1);
-        
+static void cmd_click(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    start_button_click((kmbox_button_t)args->values[0], current_time_ms);
+    reply_ok();
+}
 
-        printf(">>> ");
+static void cmd_buttons(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    if (args->count == 0) {
+        reply_state(g_kmbox_state.button_callback_enabled);
         return;
     }
-    
+    g_kmbox_state.button_callback_enabled = (args->values[0] == 1);
+    reply_ok();
+}
 
-    if (strncmp(cmd + 3, "click(", 6) == 0) {
+static void cmd_lock_button(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)current_time_ms;
+    kmbox_button_t const button = (kmbox_button_t)param;
+    if (args->count == 0) {
+        reply_state(get_button_lock(button));
+        return;
+    }
+    set_button_lock(button, args->values[0] == 1);
+    reply_ok();
+}
 
-        const char* num_start = cmd + 9; // Skip "km.click("
-        char* num_end;
-        long button_num = strtol(num_start, &num_end, 10);
-        
+static kmbox_stats_fn g_stats_source = NULL;
 
-        if (*num_end != ')' || button_num < 0 || button_num >= KMBOX_BUTTON_COUNT) {
-            return;
+// km.stats() lists every counter as name=value; km.stats(n) answers counter n,
+// which is also the only form with a binary reply worth having
+static void cmd_stats(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    (void)param;
+    (void)current_time_ms;
+    kmbox_stat_t stats[KMBOX_STATS_MAX];
+    uint8_t const count = g_stats_source ? g_stats_source(stats, KMBOX_STATS_MAX) : 0;
+
+    if (args->count == 1 || g_reply_binary) {
+        int32_t value = count;
+        if (args->count == 1 && args->values[0] < count) {
+            uint32_t const counter = stats[args->values[0]].value;
+            value = counter > INT32_MAX ? INT32_MAX : (int32_t)counter;   // Replies are signed
+        } else if (args->count == 1) {
+            value = 0;
         }
-        
-
-        start_button_click((kmbox_button_t)button_num, current_time_ms);
-        
-
-        printf(">>> ");
+        reply_values(&value, 1);
         return;
     }
-    
 
-    if (strncmp(cmd + 3, "buttons(", 8) == 0) {
-
-        const char* arg_start = cmd + 11; // Skip "km.buttons("
-        const char* paren_end = strchr(arg_start, ')');
-        
-        if (!paren_end) {
-            return;
+    for (uint8_t i = 0; i < count; i++) {
+        char text[48];
+        size_t len = strlen(stats[i].name);
+        if (len > sizeof(text) - 12) {
+            len = sizeof(text) - 12;
         }
-        
+        memcpy(text, stats[i].name, len);
+        text[len++] = '=';
+        len += format_uint(&text[len], stats[i].value);
+        text[len++] = (i + 1 < count) ? ' ' : '\r';
+        emit(text, len);
+    }
+    emit(count ? "\n" : "\r\n", count ? 1 : 2);
+    reply_ok();
+}
 
-        size_t arg_len = paren_end - arg_start;
-        if (arg_len == 0) {
+static void cmd_button(const command_args_t* args, uint8_t param, uint32_t current_time_ms)
+{
+    kmbox_button_t const button = (kmbox_button_t)param;
+    if (args->count == 0) {
+        reply_state(g_kmbox_state.buttons[button].is_pressed);
+        return;
+    }
+    set_button_state(button, args->values[0] == 1, current_time_ms);
+    reply_ok();
+}
 
-            printf("%d\r\n>>> ", g_kmbox_state.button_callback_enabled ? 1 : 0);
-            return;
-        }
-        
 
-        char state_str[8];
-        if (arg_len >= sizeof(state_str)) {
-            return;
-        }
-        
-        strncpy(state_str, arg_start, arg_len);
-        state_str[arg_len] = '\0';
-        
-
-        int state = atoi(state_str);
-        if (state != 0 && state != 1) {
-            return; // Invalid state
-        }
-        
+static const command_entry_t commands[KMBOX_OP_COUNT] = {
+    [KMBOX_OP_MOVE]     = { "move",     2, 2, { ARG_INT, ARG_INT },          0, false, cmd_move },
+    [KMBOX_OP_CATCH_XY] = { "catch_xy", 1, 1, { ARG_INT },                   0, true,  cmd_catch_xy },
+    [KMBOX_OP_WHEEL]    = { "wheel",    1, 1, { ARG_INT },                   0, false, cmd_wheel },
+    [KMBOX_OP_PAN]      = { "pan",      1, 1, { ARG_INT },                   0, false, cmd_pan },
+    [KMBOX_OP_AXIS]     = { "axis",     1, 2, { ARG_PAD_AXIS, ARG_INT },     0, false, cmd_axis },
+    [KMBOX_OP_PAD]      = { "pad",      1, 2, { ARG_PAD_BUTTON, ARG_STATE }, 0, false, cmd_pad },
+    [KMBOX_OP_HAT]      = { "hat",      1, 1, { ARG_PAD_HAT },               0, false, cmd_hat },
+    [KMBOX_OP_LOCK_MX]  = { "lock_mx",  0, 1, { ARG_STATE },                 0, false, cmd_lock_axis },
+    [KMBOX_OP_LOCK_MY]  = { "lock_my",  0, 1, { ARG_STATE },                 1, false, cmd_lock_axis },
+    [KMBOX_OP_CLICK]    = { "click",    1, 1, { ARG_BUTTON },                0, false, cmd_click },
+    [KMBOX_OP_BUTTONS]  = { "buttons",  0, 1, { ARG_STATE },                 0, false, cmd_buttons },
+    [KMBOX_OP_LOCK_ML]  = { "lock_ml",  0, 1, { ARG_STATE }, KMBOX_BUTTON_LEFT,   false, cmd_lock_button },
+    [KMBOX_OP_LOCK_MR]  = { "lock_mr",  0, 1, { ARG_STATE }, KMBOX_BUTTON_RIGHT,  false, cmd_lock_button },
+    [KMBOX_OP_LOCK_MM]  = { "lock_mm",  0, 1, { ARG_STATE }, KMBOX_BUTTON_MIDDLE, false, cmd_lock_button },
+    [KMBOX_OP_LOCK_MS1] = { "lock_ms1", 0, 1, { ARG_STATE }, KMBOX_BUTTON_SIDE1,  false, cmd_lock_button },
+    [KMBOX_OP_LOCK_MS2] = { "lock_ms2", 0, 1, { ARG_STATE }, KMBOX_BUTTON_SIDE2,  false, cmd_lock_button },
+    [KMBOX_OP_LEFT]     = { "left",     0, 1, { ARG_STATE }, KMBOX_BUTTON_LEFT,   false, cmd_button },
+    [KMBOX_OP_RIGHT]    = { "right",    0, 1, { ARG_STATE }, KMBOX_BUTTON_RIGHT,  false, cmd_button },
+    [KMBOX_OP_MIDDLE]   = { "middle",   0, 1, { ARG_STATE }, KMBOX_BUTTON_MIDDLE, false, cmd_button },
+    [KMBOX_OP_SIDE1]    = { "side1",    0, 1, { ARG_STATE }, KMBOX_BUTTON_SIDE1,  false, cmd_button },
+    [KMBOX_OP_SIDE2]    = { "side2",    0, 1, { ARG_STATE }, KMBOX_BUTTON_SIDE2,  false, cmd_button },
+    [KMBOX_OP_STATS]    = { "stats",    0, 1, { ARG_STAT },                  0, false, cmd_stats },
+};
 
-        g_kmbox_state.button_callback_enabled = (state == 1);
-        
+static const command_entry_t* find_command(const char* verb, size_t len)
+{
+    if (len == 0 || len > KMBOX_VERB_MAX) {
+        return NULL;
+    }
 
-        printf(">>> ");
-        return;
+    kmbox_opcode_t id;
+    switch (VERB_KEY(verb[0], verb[len - 1], len)) {
+    case VERB_KEY('m', 'e', 4): id = KMBOX_OP_MOVE; break;
+    case VERB_KEY('c', 'y', 8): id = KMBOX_OP_CATCH_XY; break;
+    case VERB_KEY('w', 'l', 5): id = KMBOX_OP_WHEEL; break;
+    case VERB_KEY('p', 'n', 3): id = KMBOX_OP_PAN; break;
+    case VERB_KEY('a', 's', 4): id = KMBOX_OP_AXIS; break;
+    case VERB_KEY('p', 'd', 3): id = KMBOX_OP_PAD; break;
+    case VERB_KEY('h', 't', 3): id = KMBOX_OP_HAT; break;
+    case VERB_KEY('l', 'x', 7): id = KMBOX_OP_LOCK_MX; break;
+    case VERB_KEY('l', 'y', 7): id = KMBOX_OP_LOCK_MY; break;
+    case VERB_KEY('c', 'k', 5): id = KMBOX_OP_CLICK; break;
+    case VERB_KEY('b', 's', 7): id = KMBOX_OP_BUTTONS; break;
+    case VERB_KEY('l', 'l', 7): id = KMBOX_OP_LOCK_ML; break;
+    case VERB_KEY('l', 'r', 7): id = KMBOX_OP_LOCK_MR; break;
+    case VERB_KEY('l', 'm', 7): id = KMBOX_OP_LOCK_MM; break;
+    case VERB_KEY('l', '1', 8): id = KMBOX_OP_LOCK_MS1; break;
+    case VERB_KEY('l', '2', 8): id = KMBOX_OP_LOCK_MS2; break;
+    case VERB_KEY('l', 't', 4): id = KMBOX_OP_LEFT; break;
+    case VERB_KEY('r', 't', 5): id = KMBOX_OP_RIGHT; break;
+    case VERB_KEY('m', 'e', 6): id = KMBOX_OP_MIDDLE; break;
+    case VERB_KEY('s', '1', 5): id = KMBOX_OP_SIDE1; break;
+    case VERB_KEY('s', '2', 5): id = KMBOX_OP_SIDE2; break;
+    case VERB_KEY('s', 's', 5): id = KMBOX_OP_STATS; break;
+    default: return NULL;
     }
-    
 
-    if (strncmp(cmd + 3, "lock_", 5) == 0) {
+    const command_entry_t* entry = &commands[id];
+    return (memcmp(entry->verb, verb, len) == 0 && entry->verb[len] == '\0') ? entry : NULL;
+}
 
-        const char* lock_cmd_start = cmd + 8; // Skip "km.lock_"
-        
+typedef struct {
+    const command_entry_t* entry;   // NULL when the verb is unknown
+    command_args_t args;
+} parsed_command_t;
 
-        const char* paren_start = strchr(lock_cmd_start, '(');
-        if (!paren_start) {
-            return;
-        }
-        
+// One "km.verb(args)" or "m(x, y)"; returns the character after its ')', or
+// NULL when the command is unknown or its arguments don't fit the schema
+static const char* parse_one(const char* cmd, const char* end, parsed_command_t* out)
+{
+    size_t const len = (size_t)(end - cmd);
+    const char* paren_start = NULL;
+    out->entry = NULL;
+    if (len >= 2 && cmd[0] == 'm' && cmd[1] == '(') {
+        paren_start = cmd + 1;              // "m(x, y)" is short for km.move
+        out->entry = &commands[KMBOX_OP_MOVE];
+    } else if (len > 3 && memcmp(cmd, "km.", 3) == 0) {
+        paren_start = (const char*)memchr(cmd + 3, '(', len - 3);
+        out->entry = paren_start ? find_command(cmd + 3, (size_t)(paren_start - (cmd + 3))) : NULL;
+    }
+    if (out->entry == NULL) {
+        return NULL;
+    }
 
-        const char* paren_end = strchr(paren_start, ')');
-        if (!paren_end) {
-            return;
-        }
-        
+    const char* paren_end = (const char*)memchr(paren_start, ')', (size_t)(end - paren_start));
+    if (!paren_end || !parse_args(paren_start + 1, paren_end, out->entry->max_args, &out->args) || !check_args(out->entry, &out->args)) {
+        return NULL;
+    }
+    return paren_end + 1;
+}
 
-        size_t button_name_len = paren_start - lock_cmd_start;
-        if (button_name_len >= 16) {
-            return;
-        }
-        
-        char button_name[16];
-        strncpy(button_name, lock_cmd_start, button_name_len);
-        button_name[button_name_len] = '\0';
-        
+// A line is one command or a batch, "a; b; c" or km.batch(a; b; c). A batch is
+// parsed whole before anything runs, so it applies completely or not at all,
+// and within a single kmbox_process_serial_line call it lands in one report.
+// The line is read in place between cmd and end and need not be terminated.
+static void parse_command(const char* cmd, const char* end, uint32_t current_time_ms)
+{
+    size_t const len = (size_t)(end - cmd);
+    if (!(len >= 2 && cmd[0] == 'm' && cmd[1] == '(') && !(len >= 3 && memcmp(cmd, "km.", 3) == 0)) {
+        return;
+    }
 
-        kmbox_button_t button = parse_lock_button_name(button_name);
-        if (button == KMBOX_BUTTON_COUNT) {
-            return; // Invalid button name
+    bool const wrapped = (len >= 9 && cmd[3] == 'b' && memcmp(cmd, "km.batch(", 9) == 0);
+    const char* p = wrapped ? cmd + 9 : cmd;
+
+    parsed_command_t batch[KMBOX_BATCH_MAX];
+    uint8_t count = 0;
+    bool valid = true;
+    for (;;) {
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p < end && *p == ';') {         // Empty segment, e.g. a trailing ';'
+            p++;
+            continue;
         }
-        
-
-        size_t arg_len = paren_end - paren_start - 1;
-        if (arg_len == 0) {
-
-            bool is_locked = get_button_lock(button);
-            printf("%d\r\n>>> ", is_locked ? 1 : 0);
-            return;
+        if (p == end || (wrapped && *p == ')')) {
+            break;
         }
-        
-
-        char state_str[8];
-        if (arg_len >= sizeof(state_str)) {
-            return;
+        if (count == KMBOX_BATCH_MAX || (p = parse_one(p, end, &batch[count++])) == NULL) {
+            valid = false;
+            break;
         }
-        
-        strncpy(state_str, paren_start + 1, arg_len);
-        state_str[arg_len] = '\0';
-        
-
-        int state = atoi(state_str);
-        if (state != 0 && state != 1) {
-            return; // Invalid state
+        while (p < end && isspace((unsigned char)*p)) p++;
+        if (p == end || *p != ';') {
+            break;                          // Text after the last command is ignored
         }
-        
+        p++;
+    }
+    if (valid && wrapped && (p == end || *p != ')')) {
+        valid = false;
+    }
 
-        set_button_lock(button, state == 1);
-        
 
-        printf(">>> ");
+    if (!(count == 1 && batch[0].entry != NULL && batch[0].entry->quiet)) {
+        emit(cmd, len);
+        emit(g_parser.command_terminator, g_parser.terminator_len);
+    }
+    if (!valid || count == 0) {
         return;
     }
-    
+
+    g_reply_binary = false;
+    g_reply_batch = (count > 1);
+    for (uint8_t i = 0; i < count; i++) {
+        batch[i].entry->handler(&batch[i].args, batch[i].entry->param, current_time_ms);
+    }
+    if (g_reply_batch) {
+        g_reply_batch = false;
+        emit(KMBOX_PROMPT, KMBOX_PROMPT_LEN);
+    }
+}
 
 
-    const char* paren_start = strchr(cmd + 3, '(');
-    if (!paren_start) {
+static void execute_frame(uint32_t current_time_ms)
+{
+    const uint8_t* frame = g_parser.frame;
+    uint8_t const len = g_parser.frame_pos;
+    if (crc8(frame, len - 1u) != frame[len - 1u]) {
+        g_frame_stats.crc_errors++;
         return;
     }
-    
 
-    const char* paren_end = strchr(paren_start, ')');
-    if (!paren_end) {
-        return;
+    uint8_t const opcode = frame[0] & KMBOX_FRAME_OPCODE_MASK;
+    command_args_t args;
+    args.count = (uint8_t)(frame[0] >> KMBOX_FRAME_ARGC_SHIFT);
+
+    const uint8_t* p = &frame[1];
+    for (uint8_t i = 0; i < args.count; i++) {
+        uint32_t zigzag = 0;
+        uint8_t shift = 0;
+        do {
+            zigzag |= (uint32_t)(*p & 0x7F) << shift;
+            shift += 7;
+        } while (*p++ & 0x80);
+        args.values[i] = (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1u);
     }
-    
 
-    size_t button_name_len = paren_start - (cmd + 3);
-    if (button_name_len >= 16) { // Reasonable limit for button name
+    if (opcode >= KMBOX_OP_COUNT || !check_args(&commands[opcode], &args)) {
+        g_frame_stats.rejected++;
         return;
     }
-    
-    char button_name[16];
-    strncpy(button_name, cmd + 3, button_name_len);
-    button_name[button_name_len] = '\0';
-    
+    g_frame_stats.frames++;
+    g_reply_binary = true;
+    g_reply_opcode = opcode;
+    commands[opcode].handler(&args, commands[opcode].param, current_time_ms);
+    g_reply_binary = false;
+}
 
-    char state_str[8];
-    size_t state_len = paren_end - paren_start - 1;
-    if (state_len >= sizeof(state_str)) {
+// One byte of a binary frame; the frame ends with its CRC, found from the
+// argument count in the opcode and the varints' continuation bits
+static void process_frame_byte(uint8_t byte, uint32_t current_time_ms)
+{
+    g_parser.frame[g_parser.frame_pos++] = byte;
+
+    if (g_parser.frame_pos == 1) {
+        g_parser.frame_args_left = (uint8_t)(byte >> KMBOX_FRAME_ARGC_SHIFT);
+        g_parser.varint_len = 0;
+        if (g_parser.frame_args_left > KMBOX_FRAME_MAX_ARGS) {
+            g_frame_stats.malformed++;
+            g_parser.in_frame = false;
+        }
         return;
     }
-    
-    strncpy(state_str, paren_start + 1, state_len);
-    state_str[state_len] = '\0';
-    
 
-    kmbox_button_t button = parse_button_name(button_name);
-    if (button == KMBOX_BUTTON_COUNT) {
-        return; // Invalid button name
+    if (g_parser.frame_args_left == 0) {
+        g_parser.in_frame = false;
+        execute_frame(current_time_ms);
+        return;
     }
 
-
-    {
-        const char *p = state_str;
-        while (*p && isspace((unsigned char)*p)) p++;
-        if (*p == '\0') {
-
-            int pressed = g_kmbox_state.buttons[button].is_pressed ? 1 : 0;
-            printf("%d\r\n>>> ", pressed);
-            return;
+    if (byte & 0x80) {
+        if (++g_parser.varint_len == KMBOX_FRAME_VARINT_MAX) {
+            g_frame_stats.malformed++;
+            g_parser.in_frame = false;
         }
+        return;
     }
-
-
-    int state = atoi(state_str);
-    if (state != 0 && state != 1) {
-        return; // Invalid state
-    }
-    
-
-    set_button_state(button, state == 1, current_time_ms);
-
-
-    printf(">>> ");
+    g_parser.varint_len = 0;
+    g_parser.frame_args_left--;
 }
 
 
@@ -655,6 +875,7 @@ void kmbox_commands_init(void)
 
     memset(&g_kmbox_state, 0, sizeof(g_kmbox_state));
     memset(&g_parser, 0, sizeof(g_parser));
+    memset(&g_frame_stats, 0, sizeof(g_frame_stats));
     
 
 
@@ -663,6 +884,13 @@ void kmbox_commands_init(void)
 
     g_kmbox_state.button_callback_enabled = false;
     g_kmbox_state.last_button_state = 0;
+    g_kmbox_state.gamepad.hat = KMBOX_PAD_HAT_RELEASED;
+    
+
+    kmbox_set_report_limits(-KMBOX_DEFAULT_MOVE_LIMIT, KMBOX_DEFAULT_MOVE_LIMIT,
+                            -KMBOX_DEFAULT_WHEEL_LIMIT, KMBOX_DEFAULT_WHEEL_LIMIT,
+                            -KMBOX_DEFAULT_WHEEL_LIMIT, KMBOX_DEFAULT_WHEEL_LIMIT);
+    kmbox_set_scroll_resolution(1, 1);
     
 
     printf("KMBox initialized - lock_mx=%d, lock_my=%d\n", 
@@ -672,6 +900,19 @@ void kmbox_commands_init(void)
 void kmbox_process_serial_char(char c, uint32_t current_time_ms)
 {
 
+    if (g_parser.in_frame) {
+        process_frame_byte((uint8_t)c, current_time_ms);
+        return;
+    }
+    if ((uint8_t)c == KMBOX_FRAME_SYNC) {
+        g_parser.in_frame = true;       // Any partial text line is dropped
+        g_parser.frame_pos = 0;
+        g_parser.buffer_pos = 0;
+        g_parser.in_command = false;
+        g_parser.skip_next_terminator = false;
+        return;
+    }
+
     if (c == '\n' || c == '\r') {
 
         if (g_parser.buffer_pos > 0 && !g_parser.skip_next_terminator) {
@@ -689,7 +930,7 @@ void kmbox_process_serial_char(char c, uint32_t current_time_ms)
             
 
             g_parser.buffer[g_parser.buffer_pos] = '\0';
-            parse_command(g_parser.buffer, current_time_ms);
+            parse_command(g_parser.buffer, g_parser.buffer + g_parser.buffer_pos, current_time_ms);
             
 
             g_parser.buffer_pos = 0;
@@ -718,7 +959,7 @@ void kmbox_process_serial_char(char c, uint32_t current_time_ms)
                     }
                     
                     g_parser.buffer[g_parser.buffer_pos] = '\0';
-                    parse_command(g_parser.buffer, current_time_ms);
+                    parse_command(g_parser.buffer, g_parser.buffer + g_parser.buffer_pos, current_time_ms);
                     g_parser.buffer_pos = 0;
                     g_parser.in_command = false;
                 }
@@ -756,14 +997,6 @@ void kmbox_process_serial_line(const char *line, size_t len, const char *termina
     if (len == 0 || !line) return;
 
 
-    size_t copy_len = (len >= KMBOX_CMD_BUFFER_SIZE) ? (KMBOX_CMD_BUFFER_SIZE - 1) : len;
-
-
-    memcpy(g_parser.buffer, line, copy_len);
-    g_parser.buffer[copy_len] = '\0';
-    g_parser.buffer_pos = (uint8_t)copy_len;
-
-
     if (terminator && term_len > 0) {
         size_t tl = (term_len > 2) ? 2 : term_len;
         memcpy(g_parser.command_terminator, terminator, tl);
@@ -773,7 +1006,7 @@ void kmbox_process_serial_line(const char *line, size_t len, const char *termina
     }
 
 
-    parse_command(g_parser.buffer, current_time_ms);
+    parse_command(line, line + len, current_time_ms);    // In place, no copy into the parser buffer
 
 
     g_parser.buffer_pos = 0;
@@ -781,6 +1014,28 @@ void kmbox_process_serial_line(const char *line, size_t len, const char *termina
     g_parser.skip_next_terminator = false;
 }
 
+bool kmbox_parser_idle(void)
+{
+    return !g_parser.in_frame && g_parser.buffer_pos == 0;
+}
+
+void kmbox_set_output(kmbox_output_fn output)
+{
+    g_output = output;
+}
+
+void kmbox_set_stats_source(kmbox_stats_fn source)
+{
+    g_stats_source = source;
+}
+
+void kmbox_get_frame_stats(kmbox_frame_stats_t *stats)
+{
+    if (stats) {
+        *stats = g_frame_stats;
+    }
+}
+
 void kmbox_update_states(uint32_t current_time_ms)
 {
     g_kmbox_state.last_update_time = current_time_ms;
@@ -1019,9 +1274,52 @@ void kmbox_update_states(uint32_t current_time_ms)
             g_kmbox_state.last_button_state = current_button_state;
         }
     }
+    
+    latch_button_presses();
+}
+
+static void accumulate(int32_t *accumulator, int32_t delta)
+{
+    int64_t sum = (int64_t)*accumulator + delta;
+    if (sum > INT32_MAX) {
+        sum = INT32_MAX;
+    } else if (sum < INT32_MIN) {
+        sum = INT32_MIN;
+    }
+    *accumulator = (int32_t)sum;
+}
+
+
+static int16_t clamp_accumulator(int32_t accumulator, int16_t min, int16_t max)
+{
+    if (accumulator > max) {
+        return max;
+    }
+    if (accumulator < min) {
+        return min;
+    }
+    return (int16_t)accumulator;
+}
+
+// Whole output counts in a fixed-point scroll accumulator; the remainder stays behind
+static int16_t scroll_counts(int32_t accumulator, uint8_t resolution, int16_t min, int16_t max)
+{
+    int64_t const counts = (int64_t)accumulator * resolution / KMBOX_SCROLL_UNITS_PER_DETENT;
+    if (counts > max) {
+        return max;
+    }
+    if (counts < min) {
+        return min;
+    }
+    return (int16_t)counts;
+}
+
+static int32_t scroll_units(int16_t counts, uint8_t resolution)
+{
+    return (int32_t)((int64_t)counts * KMBOX_SCROLL_UNITS_PER_DETENT / resolution);
 }
 
-void kmbox_get_mouse_report(uint8_t* buttons, int8_t* x, int8_t* y, int8_t* wheel, int8_t* pan)
+void kmbox_peek_mouse_report(uint8_t* buttons, int16_t* x, int16_t* y, int16_t* wheel, int16_t* pan)
 {
     if (!buttons || !x || !y || !wheel || !pan) {
         return;
@@ -1029,45 +1327,54 @@ void kmbox_get_mouse_report(uint8_t* buttons, int8_t* x, int8_t* y, int8_t* whee
     
 
 
-    uint8_t button_byte = 
-        (g_kmbox_state.buttons[KMBOX_BUTTON_LEFT].is_pressed   ? 0x01 : 0) |
-        (g_kmbox_state.buttons[KMBOX_BUTTON_RIGHT].is_pressed  ? 0x02 : 0) |
-        (g_kmbox_state.buttons[KMBOX_BUTTON_MIDDLE].is_pressed ? 0x04 : 0) |
-        (g_kmbox_state.buttons[KMBOX_BUTTON_SIDE1].is_pressed  ? 0x08 : 0) |
-        (g_kmbox_state.buttons[KMBOX_BUTTON_SIDE2].is_pressed  ? 0x10 : 0);
+    *buttons = current_button_byte() | g_kmbox_state.press_latch;
     
 
-    *buttons = button_byte;
-    
 
+    *x = clamp_accumulator(g_kmbox_state.mouse_x_accumulator, g_kmbox_state.move_min, g_kmbox_state.move_max);
+    *y = clamp_accumulator(g_kmbox_state.mouse_y_accumulator, g_kmbox_state.move_min, g_kmbox_state.move_max);
+    *wheel = scroll_counts(g_kmbox_state.wheel_accumulator, g_kmbox_state.wheel_resolution,
+                           g_kmbox_state.wheel_min, g_kmbox_state.wheel_max);
+    *pan = scroll_counts(g_kmbox_state.pan_accumulator, g_kmbox_state.pan_resolution,
+                         g_kmbox_state.pan_min, g_kmbox_state.pan_max);
+}
 
-    if (g_kmbox_state.mouse_x_accumulator > 127) {
-        *x = 127;
-        g_kmbox_state.mouse_x_accumulator -= 127;
-    } else if (g_kmbox_state.mouse_x_accumulator < -128) {
-        *x = -128;
-        g_kmbox_state.mouse_x_accumulator -= -128;
-    } else {
-        *x = (int8_t)g_kmbox_state.mouse_x_accumulator;
-        g_kmbox_state.mouse_x_accumulator = 0;
-    }
-    
-    if (g_kmbox_state.mouse_y_accumulator > 127) {
-        *y = 127;
-        g_kmbox_state.mouse_y_accumulator -= 127;
-    } else if (g_kmbox_state.mouse_y_accumulator < -128) {
-        *y = -128;
-        g_kmbox_state.mouse_y_accumulator -= -128;
-    } else {
-        *y = (int8_t)g_kmbox_state.mouse_y_accumulator;
-        g_kmbox_state.mouse_y_accumulator = 0;
+void kmbox_commit_mouse_report(uint8_t buttons, int16_t x, int16_t y, int16_t wheel, int16_t pan)
+{
+    accumulate(&g_kmbox_state.mouse_x_accumulator, -(int32_t)x);
+    accumulate(&g_kmbox_state.mouse_y_accumulator, -(int32_t)y);
+    accumulate(&g_kmbox_state.wheel_accumulator, -scroll_units(wheel, g_kmbox_state.wheel_resolution));
+    accumulate(&g_kmbox_state.pan_accumulator, -scroll_units(pan, g_kmbox_state.pan_resolution));
+
+    g_kmbox_state.press_latch &= (uint8_t)~buttons;
+    g_kmbox_state.committed_buttons = buttons;
+}
+
+void kmbox_get_mouse_report(uint8_t* buttons, int16_t* x, int16_t* y, int16_t* wheel, int16_t* pan)
+{
+    if (!buttons || !x || !y || !wheel || !pan) {
+        return;
     }
-    
 
-    *wheel = g_kmbox_state.wheel_accumulator;
-    g_kmbox_state.wheel_accumulator = 0;
-    
-    *pan = 0;  // No pan movement from commands
+    kmbox_peek_mouse_report(buttons, x, y, wheel, pan);
+    kmbox_commit_mouse_report(*buttons, *x, *y, *wheel, *pan);
+}
+
+void kmbox_set_report_limits(int16_t move_min, int16_t move_max, int16_t wheel_min, int16_t wheel_max,
+                             int16_t pan_min, int16_t pan_max)
+{
+    g_kmbox_state.move_min = move_min;
+    g_kmbox_state.move_max = move_max;
+    g_kmbox_state.wheel_min = wheel_min;
+    g_kmbox_state.wheel_max = wheel_max;
+    g_kmbox_state.pan_min = pan_min;
+    g_kmbox_state.pan_max = pan_max;
+}
+
+void kmbox_set_scroll_resolution(uint8_t wheel, uint8_t pan)
+{
+    g_kmbox_state.wheel_resolution = wheel ? wheel : 1;
+    g_kmbox_state.pan_resolution = pan ? pan : 1;
 }
 
 bool kmbox_has_forced_buttons(void)
@@ -1135,19 +1442,23 @@ void kmbox_update_physical_buttons(uint8_t physical_buttons)
             btn->is_pressed = (physical_buttons & 0x10) != 0;
         }
     }
+    
+    latch_button_presses();
 }
 
-void kmbox_add_mouse_movement(int16_t x, int16_t y)
+void kmbox_add_mouse_movement(int32_t x, int32_t y)
 {
 
-    int16_t ax = 0;
-    int16_t ay = 0;
+    int32_t ax = 0;
+    int32_t ay = 0;
     if (!g_kmbox_state.lock_mx) {
-        g_kmbox_state.mouse_x_accumulator += x;
+        accumulate(&g_kmbox_state.mouse_x_accumulator, x);
+        g_kmbox_state.mouse_x_fed += x;
         ax = x;
     }
     if (!g_kmbox_state.lock_my) {
-        g_kmbox_state.mouse_y_accumulator += y;
+        accumulate(&g_kmbox_state.mouse_y_accumulator, y);
+        g_kmbox_state.mouse_y_fed += y;
         ay = y;
     }
 
@@ -1157,15 +1468,38 @@ void kmbox_add_mouse_movement(int16_t x, int16_t y)
     record_movement_event(ax, ay, g_kmbox_state.last_update_time);
 }
 
-void kmbox_add_wheel_movement(int8_t wheel)
+void kmbox_get_motion_totals(int64_t* fed_x, int64_t* fed_y, int32_t* pending_x, int32_t* pending_y)
 {
-    g_kmbox_state.wheel_accumulator += wheel;
-    
+    *fed_x = g_kmbox_state.mouse_x_fed;
+    *fed_y = g_kmbox_state.mouse_y_fed;
+    *pending_x = g_kmbox_state.mouse_x_accumulator;
+    *pending_y = g_kmbox_state.mouse_y_accumulator;
+}
+
+static int32_t detent_units(int32_t detents)
+{
+    int64_t const units = (int64_t)detents * KMBOX_SCROLL_UNITS_PER_DETENT;
+    return (int32_t)(units > INT32_MAX ? INT32_MAX : (units < INT32_MIN ? INT32_MIN : units));
+}
+
+void kmbox_add_wheel_movement(int32_t wheel)
+{
+    kmbox_add_scroll_units(detent_units(wheel), 0);
+}
 
-    if (g_kmbox_state.wheel_accumulator > 127) {
-        g_kmbox_state.wheel_accumulator = 127;
-    } else if (g_kmbox_state.wheel_accumulator < -128) {
-        g_kmbox_state.wheel_accumulator = -128;
+void kmbox_add_pan_movement(int32_t pan)
+{
+    kmbox_add_scroll_units(0, detent_units(pan));
+}
+
+void kmbox_add_scroll_units(int32_t wheel, int32_t pan)
+{
+    // Dropped when the output report has no field to carry it
+    if (g_kmbox_state.wheel_min != g_kmbox_state.wheel_max) {
+        accumulate(&g_kmbox_state.wheel_accumulator, wheel);
+    }
+    if (g_kmbox_state.pan_min != g_kmbox_state.pan_max) {
+        accumulate(&g_kmbox_state.pan_accumulator, pan);
     }
 }
 
@@ -1183,4 +1517,9 @@ bool kmbox_get_lock_mx(void)
 bool kmbox_get_lock_my(void)
 {
     return g_kmbox_state.lock_my;
-}
\ No newline at end of file
+}
+
+void kmbox_get_gamepad(kmbox_gamepad_t *gamepad)
+{
+    *gamepad = g_kmbox_state.gamepad;
+}
@@ -18,6 +18,55 @@ extern "C" {
 
 
 
+#define KMBOX_SCROLL_UNITS_PER_DETENT 240  // Wheel and pan accumulate in fractions of a detent
+#define KMBOX_PAD_AXES 8                   // km.axis indices: X, Y, Z, Rx, Ry, Rz, Slider, Dial
+#define KMBOX_PAD_BUTTONS 32
+#define KMBOX_PAD_AXIS_MAX 32767           // km.axis values span the axis' whole range
+#define KMBOX_PAD_HAT_CENTER 8             // km.hat directions 0-7 run clockwise from up
+#define KMBOX_PAD_HAT_RELEASED -1
+
+
+// Binary frames: KMBOX_FRAME_SYNC, opcode | (argument count << 5), each argument
+// as a zigzag LEB128 varint, then CRC-8 (poly 0x07, init 0) over opcode and
+// arguments. km.move(-12, 7) is A5 40 17 0E 90. Query replies use the same format.
+#define KMBOX_FRAME_SYNC 0xA5              // Never valid in a text command
+#define KMBOX_FRAME_OPCODE_MASK 0x1F
+#define KMBOX_FRAME_ARGC_SHIFT 5
+#define KMBOX_FRAME_MAX_ARGS 2
+#define KMBOX_FRAME_VARINT_MAX 5           // Bytes in an int32 varint
+#define KMBOX_FRAME_MAX (2 + KMBOX_FRAME_MAX_ARGS * KMBOX_FRAME_VARINT_MAX + 1)
+
+
+
+
+
+// Binary opcodes; the text verb each one stands for is in the comment
+typedef enum {
+    KMBOX_OP_MOVE = 0,      // move
+    KMBOX_OP_CATCH_XY,      // catch_xy
+    KMBOX_OP_WHEEL,         // wheel
+    KMBOX_OP_PAN,           // pan
+    KMBOX_OP_AXIS,          // axis
+    KMBOX_OP_PAD,           // pad
+    KMBOX_OP_HAT,           // hat
+    KMBOX_OP_LOCK_MX,       // lock_mx
+    KMBOX_OP_LOCK_MY,       // lock_my
+    KMBOX_OP_CLICK,         // click
+    KMBOX_OP_BUTTONS,       // buttons
+    KMBOX_OP_LOCK_ML,       // lock_ml
+    KMBOX_OP_LOCK_MR,       // lock_mr
+    KMBOX_OP_LOCK_MM,       // lock_mm
+    KMBOX_OP_LOCK_MS1,      // lock_ms1
+    KMBOX_OP_LOCK_MS2,      // lock_ms2
+    KMBOX_OP_LEFT,          // left
+    KMBOX_OP_RIGHT,         // right
+    KMBOX_OP_MIDDLE,        // middle
+    KMBOX_OP_SIDE1,         // side1
+    KMBOX_OP_SIDE2,         // side2
+    KMBOX_OP_STATS,         // stats
+    KMBOX_OP_COUNT
+} kmbox_opcode_t;
+
 typedef enum {
     KMBOX_BUTTON_LEFT = 0,
     KMBOX_BUTTON_RIGHT,
@@ -41,28 +90,55 @@ typedef struct {
     bool is_locked;  // True if button is locked (physical input masked from output)
 } button_state_t;
 
+// Gamepad input held by km.axis, km.pad and km.hat, laid over the attached gamepad's own
+typedef struct {
+    uint32_t buttons;             // Held pressed
+    uint8_t axis_mask;            // Axes held at axes[]
+    int16_t axes[KMBOX_PAD_AXES]; // -KMBOX_PAD_AXIS_MAX..KMBOX_PAD_AXIS_MAX
+    int8_t hat;                   // 0-7, KMBOX_PAD_HAT_CENTER, or KMBOX_PAD_HAT_RELEASED
+    uint32_t sequence;            // Bumped on every change
+} kmbox_gamepad_t;
+
 typedef struct {
     button_state_t buttons[KMBOX_BUTTON_COUNT];
     uint8_t physical_buttons;  // Actual physical button states
     uint32_t last_update_time;
     bool button_callback_enabled;  // True if button state change callback is enabled
     uint8_t last_button_state;     // Last reported button state for callback
+    uint8_t committed_buttons;     // Buttons in the last report the PC acknowledged
+    uint8_t press_latch;           // Presses not yet acknowledged, kept even if already released
+    
+
+    int32_t mouse_x_accumulator;  // Accumulated X movement
+    int32_t mouse_y_accumulator;  // Accumulated Y movement
+    int32_t wheel_accumulator;    // Accumulated wheel movement, KMBOX_SCROLL_UNITS_PER_DETENT per detent
+    int32_t pan_accumulator;      // Accumulated horizontal scroll, same units
+    int64_t mouse_x_fed;          // Running sums of X/Y taken into the accumulators,
+    int64_t mouse_y_fed;          // physical and injected, after the axis locks
     
 
-    int16_t mouse_x_accumulator;  // Accumulated X movement
-    int16_t mouse_y_accumulator;  // Accumulated Y movement
-    int8_t wheel_accumulator;      // Accumulated wheel movement
+    int16_t move_min;             // Per-report X/Y limits of the output descriptor
+    int16_t move_max;
+    int16_t wheel_min;            // Per-report wheel limits of the output descriptor
+    int16_t wheel_max;
+    int16_t pan_min;              // Per-report AC Pan limits of the output descriptor
+    int16_t pan_max;
+    uint8_t wheel_resolution;     // Output report counts per detent (Resolution Multiplier)
+    uint8_t pan_resolution;
     
 
     bool lock_mx;  // Lock X axis (left/right movement)
     bool lock_my;  // Lock Y axis (up/down movement)
+    
+
+    kmbox_gamepad_t gamepad;
 } kmbox_state_t;
 
 
 
 
 
-#define KMBOX_CMD_BUFFER_SIZE 64
+#define KMBOX_CMD_BUFFER_SIZE 128          // Room for a batch of several commands on one line
 
 typedef struct {
     char buffer[KMBOX_CMD_BUFFER_SIZE];
@@ -72,8 +148,36 @@ typedef struct {
     char last_terminator;       // Track last terminator seen ('\r' or '\n')
     char command_terminator[3]; // Store the line terminator(s) used for current command
     uint8_t terminator_len;     // Length of the terminator (1 for \n or \r, 2 for \r\n)
+    
+
+    bool in_frame;              // Inside a binary frame; text parsing resumes after it
+    uint8_t frame[KMBOX_FRAME_MAX];
+    uint8_t frame_pos;          // Bytes of the frame after the sync byte
+    uint8_t frame_args_left;    // Varints still to come; the CRC follows the last
+    uint8_t varint_len;         // Bytes of the varint in progress
 } kmbox_parser_t;
 
+typedef struct {
+    uint32_t frames;            // Binary frames executed
+    uint32_t crc_errors;
+    uint32_t malformed;         // Bad argument count or overlong varint
+    uint32_t rejected;          // Unknown opcode or arguments outside the command's schema
+} kmbox_frame_stats_t;
+
+// Raw bytes out for every echo, prompt and reply, text or binary. Called from
+// command processing, so it must not block; NULL writes to stdout.
+typedef void (*kmbox_output_fn)(const uint8_t *data, size_t len);
+
+#define KMBOX_STATS_MAX 16
+
+typedef struct {
+    const char *name;
+    uint32_t value;
+} kmbox_stat_t;
+
+// Fills in up to max counters for km.stats and returns how many it wrote
+typedef uint8_t (*kmbox_stats_fn)(kmbox_stat_t *stats, uint8_t max);
+
 
 
 
@@ -85,22 +189,55 @@ void kmbox_commands_init(void);
 void kmbox_process_serial_char(char c, uint32_t current_time_ms);
 
 
+// No partial text line or binary frame is waiting for more bytes
+bool kmbox_parser_idle(void);
+
 
+void kmbox_set_output(kmbox_output_fn output);
+void kmbox_set_stats_source(kmbox_stats_fn source);
+void kmbox_get_frame_stats(kmbox_frame_stats_t *stats);
 
 
+
+
+
+// The line is parsed where it lies, e.g. straight out of a receive ring; it
+// only has to stay put for the duration of the call
 void kmbox_process_serial_line(const char *line, size_t len, const char *terminator, uint8_t term_len, uint32_t current_time_ms);
 
 
 void kmbox_update_states(uint32_t current_time_ms);
 
 
-void kmbox_get_mouse_report(uint8_t* buttons, int8_t* x, int8_t* y, int8_t* wheel, int8_t* pan);
+void kmbox_get_mouse_report(uint8_t* buttons, int16_t* x, int16_t* y, int16_t* wheel, int16_t* pan);
+
+
+void kmbox_peek_mouse_report(uint8_t* buttons, int16_t* x, int16_t* y, int16_t* wheel, int16_t* pan);
+void kmbox_commit_mouse_report(uint8_t buttons, int16_t x, int16_t y, int16_t wheel, int16_t pan);
 
 
-void kmbox_add_mouse_movement(int16_t x, int16_t y);
+void kmbox_set_report_limits(int16_t move_min, int16_t move_max, int16_t wheel_min, int16_t wheel_max,
+                             int16_t pan_min, int16_t pan_max);
 
 
-void kmbox_add_wheel_movement(int8_t wheel);
+// Counts per detent the PC currently expects in the wheel and pan fields
+void kmbox_set_scroll_resolution(uint8_t wheel, uint8_t pan);
+
+
+void kmbox_add_mouse_movement(int32_t x, int32_t y);
+
+
+// Motion taken in so far and what the accumulators still hold. While none is
+// lost, fed is what the PC acknowledged plus pending.
+void kmbox_get_motion_totals(int64_t* fed_x, int64_t* fed_y, int32_t* pending_x, int32_t* pending_y);
+
+
+void kmbox_add_wheel_movement(int32_t wheel);
+void kmbox_add_pan_movement(int32_t pan);
+
+
+// Sub-detent scrolling, in KMBOX_SCROLL_UNITS_PER_DETENT per detent
+void kmbox_add_scroll_units(int32_t wheel, int32_t pan);
 
 
 void kmbox_set_axis_lock(bool lock_x, bool lock_y);
@@ -113,6 +250,9 @@ bool kmbox_get_lock_my(void);
 bool kmbox_has_forced_buttons(void);
 
 
+void kmbox_get_gamepad(kmbox_gamepad_t *gamepad);
+
+
 const char* kmbox_get_button_name(kmbox_button_t button);
 
 
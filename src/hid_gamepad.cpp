@@ -0,0 +1,75 @@
+/*
+ * Hurricane vbox Firmware
+ */
+
+#include "hid_gamepad.h"
+#include <stddef.h>
+
+
+static int32_t axis_from_normalized(const hid_field_t *field, int16_t value)
+{
+    int32_t min, max;
+    hid_field_get_range(field, &min, &max);
+
+    int32_t const clamped = value < -HID_GAMEPAD_AXIS_MAX ? -HID_GAMEPAD_AXIS_MAX : value;
+    int64_t const span = (int64_t)max - min;
+    int64_t const offset = ((int64_t)(clamped + HID_GAMEPAD_AXIS_MAX) * span + HID_GAMEPAD_AXIS_MAX) /
+                           (2 * HID_GAMEPAD_AXIS_MAX);
+    return (int32_t)(min + offset);
+}
+
+// Four-way hats take the nearest cardinal direction; centered is the first value
+// past the range, which is how hats report their null state
+static int32_t hat_from_direction(const hid_field_t *field, int8_t direction)
+{
+    int32_t min, max;
+    hid_field_get_range(field, &min, &max);
+
+    if (direction < 0 || direction >= HID_GAMEPAD_HAT_CENTER) {
+        return ((uint32_t)max + 1u <= field->mask) ? max + 1 : min - 1;
+    }
+    if (max - min + 1 < 8) {
+        return min + direction / 2;
+    }
+    return min + direction;
+}
+
+bool hid_gamepad_decode(const hid_gamepad_layout_t *layout, const uint8_t *report, uint16_t len,
+                        hid_gamepad_state_t *state)
+{
+    if (!layout->present || len < layout->report_bytes || (layout->report_id != 0 && report[0] != layout->report_id)) {
+        return false;
+    }
+
+    for (uint8_t i = 0; i < HID_PLAN_MAX_AXES; i++) {
+        state->axes[i] = layout->axes[i].bit_size != 0 ? hid_field_extract(report, &layout->axes[i]) : 0;
+    }
+    state->hat = layout->hat.bit_size != 0 ? hid_field_extract(report, &layout->hat) : 0;
+    state->buttons = layout->buttons.bit_size != 0 ? (uint32_t)hid_field_extract(report, &layout->buttons) : 0;
+    return true;
+}
+
+void hid_gamepad_encode(const hid_gamepad_layout_t *layout, const hid_gamepad_state_t *state, uint8_t *report)
+{
+    for (uint8_t i = 0; i < HID_PLAN_MAX_AXES; i++) {
+        hid_field_insert(report, &layout->axes[i], state->axes[i]);
+    }
+    hid_field_insert(report, &layout->hat, state->hat);
+    hid_field_insert(report, &layout->buttons, (int32_t)state->buttons);
+}
+
+void hid_gamepad_apply_override(const hid_gamepad_layout_t *layout, const hid_gamepad_override_t *override,
+                                hid_gamepad_state_t *state)
+{
+    state->buttons |= override->buttons & layout->buttons.mask;
+
+    for (uint8_t i = 0; i < HID_PLAN_MAX_AXES; i++) {
+        if ((override->axis_mask & (1u << i)) && layout->axes[i].bit_size != 0) {
+            state->axes[i] = axis_from_normalized(&layout->axes[i], override->axes[i]);
+        }
+    }
+
+    if (override->hat != HID_GAMEPAD_HAT_RELEASED && layout->hat.bit_size != 0) {
+        state->hat = hat_from_direction(&layout->hat, override->hat);
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * Hurricane vbox Firmware
+ */
+
+#include "hid_keyboard.h"
+#include <stddef.h>
+
+
+#define HID_KEY_ERROR_ROLLOVER  0x01
+#define HID_KEY_FIRST_REAL      0x04    // 00-03 are "no key" and error codes
+
+
+static inline uint32_t read_bits(const uint8_t *report, uint16_t bit_offset, uint8_t bit_size)
+{
+    uint8_t const shift = bit_offset & 7u;
+    const uint8_t *p = report + (bit_offset >> 3);
+    uint32_t raw = p[0];
+    if (shift + bit_size > 8) {
+        raw |= (uint32_t)p[1] << 8;
+    }
+    return (raw >> shift) & ((1u << bit_size) - 1u);
+}
+
+static void decode_bitmap(const hid_key_field_t *run, const uint8_t *report, hid_key_bitmap_t *keys)
+{
+    uint16_t count = run->count;
+    if ((uint16_t)run->usage_first + count > 256u) {
+        count = (uint16_t)(256u - run->usage_first);
+    }
+
+
+    if ((run->bit_offset & 7u) == 0 && (run->usage_first & 7u) == 0) {
+        const uint8_t *p = report + (run->bit_offset >> 3);
+        uint16_t usage = run->usage_first;
+        uint16_t i = 0;
+        for (; i + 8 <= count; i += 8, usage += 8) {
+            keys->words[usage >> 5] |= (uint32_t)*p++ << (usage & 31u);
+        }
+        if (i < count) {
+            uint32_t const tail = *p & ((1u << (count - i)) - 1u);
+            keys->words[usage >> 5] |= tail << (usage & 31u);
+        }
+        return;
+    }
+
+    for (uint16_t i = 0; i < count; i++) {
+        if (read_bits(report, (uint16_t)(run->bit_offset + i), 1)) {
+            hid_key_bitmap_set(keys, (uint8_t)(run->usage_first + i), true);
+        }
+    }
+}
+
+static bool decode_array(const hid_key_field_t *array, const uint8_t *report, hid_key_bitmap_t *keys)
+{
+    for (uint16_t i = 0; i < array->count; i++) {
+        int32_t const value = (int32_t)read_bits(report, (uint16_t)(array->bit_offset + i * array->bit_size), array->bit_size);
+        if (value < array->logical_min || value > array->logical_max) {
+            continue;
+        }
+
+        uint32_t const usage = array->usage_first + (uint32_t)(value - array->logical_min);
+        if (usage == HID_KEY_ERROR_ROLLOVER) {
+            return false;
+        }
+        if (usage >= HID_KEY_FIRST_REAL && usage <= 0xFFu) {
+            hid_key_bitmap_set(keys, (uint8_t)usage, true);
+        }
+    }
+    return true;
+}
+
+bool hid_keyboard_decode(const hid_report_plan_t *plan, const uint8_t *report, uint16_t len, hid_key_bitmap_t *keys)
+{
+    const hid_report_layout_t *layout = hid_report_plan_find(plan, report, len);
+    if (layout == NULL || !layout->has_keyboard || len < layout->report_bytes) {
+        return false;
+    }
+
+    hid_key_bitmap_t decoded;
+    hid_key_bitmap_clear(&decoded);
+
+    for (uint8_t i = 0; i < HID_PLAN_MAX_KEY_BITMAPS; i++) {
+        if (layout->key_bitmaps[i].count != 0) {
+            decode_bitmap(&layout->key_bitmaps[i], report, &decoded);
+        }
+    }
+    if (layout->key_array.count != 0 && !decode_array(&layout->key_array, report, &decoded)) {
+        return false;
+    }
+
+
+    decoded.words[0] &= ~((1u << HID_KEY_FIRST_REAL) - 1u);
+    *keys = decoded;
+    return true;
+}
+
+void hid_keyboard_encode_nkro(const hid_key_bitmap_t *keys, uint8_t *report)
+{
+    report[0] = (uint8_t)(keys->words[HID_KEY_MODIFIER_FIRST >> 5] >> (HID_KEY_MODIFIER_FIRST & 31u));
+    report[1] = 0;
+
+    for (uint8_t n = 0; n < HID_KEY_NKRO_USAGES / 8; n++) {
+        report[2 + n] = (uint8_t)(keys->words[n >> 2] >> ((n & 3u) * 8u));
+    }
+}
@@ -0,0 +1,353 @@
+/*
+ * Hurricane vbox Firmware
+ */
+
+#include "hid_mouse_decoder.h"
+#include "pico/stdlib.h"
+#include <string.h>
+
+#if defined(__arm__) && PICO_RP2350
+#include "hardware/structs/m33.h"
+#endif
+
+
+
+
+
+#if defined(__riscv)
+
+static inline void cycle_counter_start(void)
+{
+    __asm volatile("csrci mcountinhibit, 1");
+}
+
+static inline uint32_t cycle_counter_read(void)
+{
+    uint32_t cycles;
+    __asm volatile("csrr %0, mcycle" : "=r"(cycles));
+    return cycles;
+}
+
+static inline uint32_t cycle_counter_elapsed(uint32_t start, uint32_t end)
+{
+    return end - start;
+}
+
+#elif defined(__arm__) && PICO_RP2350
+
+
+// The Cortex-M33 DWT cycle counter; enabling it leaves every timer alone
+static inline void cycle_counter_start(void)
+{
+    m33_hw->demcr |= M33_DEMCR_TRCENA_BITS;
+    m33_hw->dwt_ctrl |= M33_DWT_CTRL_CYCCNTENA_BITS;
+}
+
+static inline uint32_t cycle_counter_read(void)
+{
+    return m33_hw->dwt_cyccnt;
+}
+
+static inline uint32_t cycle_counter_elapsed(uint32_t start, uint32_t end)
+{
+    return end - start;
+}
+
+#else
+
+// The Cortex-M0+ has no cycle counter short of SysTick, which is left to the
+// SDK, so the RP2040 profiles in microseconds
+static inline void cycle_counter_start(void)
+{
+}
+
+static inline uint32_t cycle_counter_read(void)
+{
+    return time_us_32();
+}
+
+static inline uint32_t cycle_counter_elapsed(uint32_t start, uint32_t end)
+{
+    return end - start;
+}
+
+#endif
+
+
+
+
+
+static constexpr uint32_t FNV_OFFSET_BASIS = 2166136261u;
+static constexpr uint32_t FNV_PRIME = 16777619u;
+
+static constexpr uint32_t fnv_mix_u32(uint32_t hash, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        hash = (hash ^ (value & 0xFFu)) * FNV_PRIME;
+        value >>= 8;
+    }
+    return hash;
+}
+
+static constexpr uint32_t fingerprint_field(uint32_t hash, uint16_t bit_offset, uint8_t bit_size, bool is_signed)
+{
+    return fnv_mix_u32(hash, (uint32_t)bit_offset | ((uint32_t)bit_size << 16) | ((uint32_t)is_signed << 24));
+}
+
+
+template <uint16_t BitOffset, uint8_t Bits, bool Signed>
+struct FixedField {
+    static constexpr uint16_t kBitOffset = BitOffset;
+    static constexpr uint8_t kBits = Bits;
+    static constexpr bool kSigned = Signed;
+    static constexpr uint8_t kByte = BitOffset >> 3;
+    static constexpr uint8_t kShift = BitOffset & 7u;
+    static constexpr uint8_t kSpan = (kShift + Bits + 7u) / 8u;
+    static constexpr uint32_t kMask = (Bits >= 32) ? 0xFFFFFFFFu : ((1u << Bits) - 1u);
+    static constexpr uint8_t kSignShift = Signed ? (uint8_t)(32u - Bits) : 0u;
+
+    static_assert(kShift + Bits <= 32, "Field must fit a 32-bit extraction window");
+
+    static inline int32_t extract(const uint8_t *report)
+    {
+        if constexpr (Bits == 0) {
+            (void)report;
+            return 0;
+        } else {
+            uint32_t raw = report[kByte];
+            if constexpr (kSpan > 1) raw |= (uint32_t)report[kByte + 1] << 8;
+            if constexpr (kSpan > 2) raw |= (uint32_t)report[kByte + 2] << 16;
+            if constexpr (kSpan > 3) raw |= (uint32_t)report[kByte + 3] << 24;
+            raw = (raw >> kShift) & kMask;
+            return (int32_t)(raw << kSignShift) >> kSignShift;
+        }
+    }
+};
+
+using NoField = FixedField<0, 0, false>;
+
+
+template <typename Buttons, typename X, typename Y, typename Wheel, typename Pan>
+struct MouseLayout {
+    static constexpr uint32_t fingerprint()
+    {
+        uint32_t hash = FNV_OFFSET_BASIS;
+        hash = fingerprint_field(hash, Buttons::kBitOffset, Buttons::kBits, Buttons::kSigned);
+        hash = fingerprint_field(hash, X::kBitOffset, X::kBits, X::kSigned);
+        hash = fingerprint_field(hash, Y::kBitOffset, Y::kBits, Y::kSigned);
+        hash = fingerprint_field(hash, Wheel::kBitOffset, Wheel::kBits, Wheel::kSigned);
+        hash = fingerprint_field(hash, Pan::kBitOffset, Pan::kBits, Pan::kSigned);
+        return hash;
+    }
+
+    static bool decode(const hid_mouse_decoder_t *decoder, const uint8_t *report, uint16_t len, hid_mouse_sample_t *out)
+    {
+        if (len < decoder->report_bytes) {
+            return hid_mouse_decode_generic(decoder, report, len, out);
+        }
+        if (decoder->check_report_id && report[0] != decoder->report_id) {
+            return false;
+        }
+
+        out->buttons = (uint16_t)Buttons::extract(report) & decoder->buttons_mask;
+        out->x = (int16_t)X::extract(report);
+        out->y = (int16_t)Y::extract(report);
+        out->wheel = (int16_t)Wheel::extract(report);
+        out->pan = (int16_t)Pan::extract(report);
+        return true;
+    }
+};
+
+
+using BootMouse3 = MouseLayout<FixedField<0, 8, false>, FixedField<8, 8, true>, FixedField<16, 8, true>,
+                               NoField, NoField>;
+
+using BootMouse4 = MouseLayout<FixedField<0, 8, false>, FixedField<8, 8, true>, FixedField<16, 8, true>,
+                               FixedField<24, 8, true>, NoField>;
+
+using BootMouse5 = MouseLayout<FixedField<0, 8, false>, FixedField<8, 8, true>, FixedField<16, 8, true>,
+                               FixedField<24, 8, true>, FixedField<32, 8, true>>;
+
+using ReportIdMouse8 = MouseLayout<FixedField<8, 8, false>, FixedField<16, 8, true>, FixedField<24, 8, true>,
+                                   FixedField<32, 8, true>, FixedField<40, 8, true>>;
+
+using Mouse16Tail = MouseLayout<FixedField<0, 8, false>, FixedField<32, 16, true>, FixedField<48, 16, true>,
+                                FixedField<8, 8, true>, NoField>;
+
+using Logitech16 = MouseLayout<FixedField<0, 16, false>, FixedField<16, 16, true>, FixedField<32, 16, true>,
+                               FixedField<48, 8, true>, FixedField<56, 8, true>>;
+
+using LogitechReceiver12 = MouseLayout<FixedField<8, 16, false>, FixedField<24, 12, true>, FixedField<36, 12, true>,
+                                       FixedField<48, 8, true>, FixedField<56, 8, true>>;
+
+using Razer16 = MouseLayout<FixedField<0, 8, false>, FixedField<16, 16, true>, FixedField<32, 16, true>,
+                            FixedField<48, 8, true>, NoField>;
+
+
+typedef struct {
+    uint32_t fingerprint;
+    hid_mouse_decode_fn decode;
+    const char *name;
+} fast_decoder_entry_t;
+
+static const fast_decoder_entry_t fast_decoders[] = {
+    { BootMouse3::fingerprint(),         BootMouse3::decode,         "boot3" },
+    { BootMouse4::fingerprint(),         BootMouse4::decode,         "boot4" },
+    { BootMouse5::fingerprint(),         BootMouse5::decode,         "boot5" },
+    { ReportIdMouse8::fingerprint(),     ReportIdMouse8::decode,     "id8" },
+    { Mouse16Tail::fingerprint(),        Mouse16Tail::decode,        "xy16-tail" },
+    { Logitech16::fingerprint(),         Logitech16::decode,         "logitech16" },
+    { LogitechReceiver12::fingerprint(), LogitechReceiver12::decode, "logitech12" },
+    { Razer16::fingerprint(),            Razer16::decode,            "razer16" },
+};
+
+
+static hid_decoder_stats_t g_decoder_stats;
+static bool g_cycle_counter_started = false;
+
+
+
+
+
+static inline int16_t saturate_int16(int32_t value)
+{
+    return (int16_t)((value > 32767) ? 32767 : ((value < -32768) ? -32768 : value));
+}
+
+static uint32_t layout_fingerprint(const hid_report_layout_t *layout)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (int f = 0; f < HID_FIELD_COUNT; f++) {
+        const hid_field_t *field = &layout->fields[f];
+        uint8_t bits = field->bit_size;
+
+
+        if (f == HID_FIELD_BUTTONS && bits != 0 && (field->bit_offset & 7u) == 0) {
+            bits = (uint8_t)((bits + 7u) & ~7u);
+        }
+        hash = fingerprint_field(hash, field->bit_offset, bits, field->sign_shift != 0);
+    }
+    return hash;
+}
+
+uint32_t hid_descriptor_hash(const uint8_t *desc, uint16_t desc_len)
+{
+    uint32_t hash = FNV_OFFSET_BASIS;
+    for (uint16_t i = 0; desc && i < desc_len; i++) {
+        hash = (hash ^ desc[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+bool hid_mouse_decode_generic(const hid_mouse_decoder_t *decoder, const uint8_t *report, uint16_t len, hid_mouse_sample_t *out)
+{
+    const hid_report_layout_t *layout = hid_report_plan_find(&decoder->plan, report, len);
+    if (layout == NULL || !layout->has_pointer) {
+        return false;
+    }
+
+
+    uint8_t padded[HID_PLAN_MAX_REPORT_BYTES];
+    if (len < layout->report_bytes) {
+        memset(padded, 0, sizeof(padded));
+        memcpy(padded, report, len < sizeof(padded) ? len : sizeof(padded));
+        report = padded;
+    }
+
+    const hid_field_t *fields = layout->fields;
+    out->buttons = (uint16_t)hid_field_extract(report, &fields[HID_FIELD_BUTTONS]);
+    out->x = saturate_int16(hid_field_extract(report, &fields[HID_FIELD_X]));
+    out->y = saturate_int16(hid_field_extract(report, &fields[HID_FIELD_Y]));
+    out->wheel = saturate_int16(hid_field_extract(report, &fields[HID_FIELD_WHEEL]));
+    out->pan = saturate_int16(hid_field_extract(report, &fields[HID_FIELD_PAN]));
+    return true;
+}
+
+void hid_mouse_decoder_init(hid_mouse_decoder_t *decoder, const hid_report_plan_t *plan,
+                            const uint8_t *desc, uint16_t desc_len)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->plan = *plan;
+    decoder->decode = hid_mouse_decode_generic;
+    decoder->name = "generic";
+    decoder->descriptor_hash = hid_descriptor_hash(desc, desc_len);
+
+
+    const hid_report_layout_t *pointer = NULL;
+    for (uint8_t i = 0; i < plan->report_count; i++) {
+        if (!plan->reports[i].has_pointer) {
+            continue;
+        }
+        if (pointer != NULL) {
+            return;
+        }
+        pointer = &plan->reports[i];
+    }
+    if (pointer == NULL) {
+        return;
+    }
+
+    uint8_t const button_bits = pointer->fields[HID_FIELD_BUTTONS].bit_size;
+    decoder->buttons_mask = (uint16_t)((button_bits >= 16) ? 0xFFFFu : ((1u << button_bits) - 1u));
+    decoder->check_report_id = plan->uses_report_ids;
+    decoder->report_id = pointer->report_id;
+    decoder->report_bytes = pointer->report_bytes;
+    decoder->layout_fingerprint = layout_fingerprint(pointer);
+
+    for (size_t i = 0; i < sizeof(fast_decoders) / sizeof(fast_decoders[0]); i++) {
+        if (fast_decoders[i].fingerprint == decoder->layout_fingerprint) {
+            decoder->decode = fast_decoders[i].decode;
+            decoder->name = fast_decoders[i].name;
+            decoder->fast_path = true;
+            break;
+        }
+    }
+}
+
+void hid_mouse_decoder_profile(const hid_mouse_decoder_t *decoder, const uint8_t *report, uint16_t len)
+{
+    if (!g_cycle_counter_started) {
+        cycle_counter_start();
+        g_cycle_counter_started = true;
+    }
+
+    hid_mouse_sample_t generic_sample = {0};
+    uint32_t start = cycle_counter_read();
+    bool const generic_ok = hid_mouse_decode_generic(decoder, report, len, &generic_sample);
+    uint32_t const generic_cycles = cycle_counter_elapsed(start, cycle_counter_read());
+
+    g_decoder_stats.generic_samples++;
+    g_decoder_stats.generic_cycles += generic_cycles;
+
+    if (!decoder->fast_path) {
+        return;
+    }
+
+    hid_mouse_sample_t fast_sample = {0};
+    start = cycle_counter_read();
+    bool const fast_ok = decoder->decode(decoder, report, len, &fast_sample);
+    uint32_t const fast_cycles = cycle_counter_elapsed(start, cycle_counter_read());
+
+    g_decoder_stats.fast_samples++;
+    g_decoder_stats.fast_cycles += fast_cycles;
+
+
+    if (fast_ok != generic_ok ||
+        (fast_ok && ((fast_sample.buttons ^ generic_sample.buttons) & decoder->buttons_mask ||
+                     fast_sample.x != generic_sample.x || fast_sample.y != generic_sample.y ||
+                     fast_sample.wheel != generic_sample.wheel || fast_sample.pan != generic_sample.pan))) {
+        g_decoder_stats.mismatches++;
+    }
+}
+
+void hid_mouse_decoder_get_stats(hid_decoder_stats_t *stats)
+{
+    if (stats) {
+        *stats = g_decoder_stats;
+    }
+}
+
+void hid_mouse_decoder_reset_stats(void)
+{
+    memset(&g_decoder_stats, 0, sizeof(g_decoder_stats));
+}
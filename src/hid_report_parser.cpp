@@ -0,0 +1,679 @@
+/*
+ * Hurricane vbox Firmware
+ */
+
+#include "hid_report_parser.h"
+#include "tusb.h"
+#include <string.h>
+
+
+#define HID_ITEM_TYPE_MAIN      0
+#define HID_ITEM_TYPE_GLOBAL    1
+#define HID_ITEM_TYPE_LOCAL     2
+#define HID_ITEM_LONG_PREFIX    0xFE
+
+#define HID_MAIN_INPUT          0x8
+#define HID_MAIN_OUTPUT         0x9
+#define HID_MAIN_COLLECTION     0xA
+#define HID_MAIN_FEATURE        0xB
+#define HID_MAIN_END_COLLECTION 0xC
+
+#define HID_GLOBAL_USAGE_PAGE   0x0
+#define HID_GLOBAL_LOGICAL_MIN  0x1
+#define HID_GLOBAL_LOGICAL_MAX  0x2
+#define HID_GLOBAL_PHYSICAL_MIN 0x3
+#define HID_GLOBAL_PHYSICAL_MAX 0x4
+#define HID_GLOBAL_REPORT_SIZE  0x7
+#define HID_GLOBAL_REPORT_ID    0x8
+#define HID_GLOBAL_REPORT_COUNT 0x9
+#define HID_GLOBAL_PUSH         0xA
+#define HID_GLOBAL_POP          0xB
+
+#define HID_LOCAL_USAGE         0x0
+#define HID_LOCAL_USAGE_MIN     0x1
+#define HID_LOCAL_USAGE_MAX     0x2
+
+#define HID_INPUT_CONSTANT      0x01
+#define HID_INPUT_VARIABLE      0x02
+
+#define HID_PARSER_MAX_USAGES   16
+#define HID_PARSER_STACK_DEPTH  4
+#define HID_MAX_BUTTON_BITS     16
+
+
+typedef struct {
+    uint16_t usage_page;
+    int32_t logical_min;
+    int32_t logical_max;
+    int32_t physical_min;
+    int32_t physical_max;
+    uint32_t report_size;
+    uint32_t report_count;
+    uint8_t report_id;
+} hid_global_state_t;
+
+// Feature report lengths, only needed to size the multiplier reports
+typedef struct {
+    uint8_t report_ids[HID_PLAN_MAX_REPORTS];
+    uint16_t bits[HID_PLAN_MAX_REPORTS];
+    uint8_t count;
+} hid_feature_bits_t;
+
+typedef struct {
+    uint32_t usages[HID_PARSER_MAX_USAGES];   // (page << 16) | usage
+    uint8_t usage_count;
+    uint32_t usage_min;
+    uint32_t usage_max;
+    bool has_range;
+} hid_local_state_t;
+
+
+static hid_report_layout_t *plan_get_report(hid_report_plan_t *plan, uint16_t *input_bits, uint8_t report_id)
+{
+    for (uint8_t i = 0; i < plan->report_count; i++) {
+        if (plan->reports[i].report_id == report_id) {
+            return &plan->reports[i];
+        }
+    }
+    if (plan->report_count >= HID_PLAN_MAX_REPORTS) {
+        return NULL;
+    }
+
+    hid_report_layout_t *layout = &plan->reports[plan->report_count];
+    memset(layout, 0, sizeof(*layout));
+    layout->report_id = report_id;
+    input_bits[plan->report_count] = 0;
+    plan->report_count++;
+    return layout;
+}
+
+static uint32_t local_usage_at(const hid_local_state_t *local, uint32_t index)
+{
+    if (local->usage_count > 0) {
+        return local->usages[index < local->usage_count ? index : local->usage_count - 1];
+    }
+    if (local->has_range) {
+        uint32_t usage = local->usage_min + index;
+        return usage > local->usage_max ? local->usage_max : usage;
+    }
+    return 0;
+}
+
+static int role_for_usage(uint16_t page, uint16_t usage)
+{
+    switch (page) {
+    case HID_USAGE_PAGE_BUTTON:
+        return HID_FIELD_BUTTONS;
+    case HID_USAGE_PAGE_DESKTOP:
+        if (usage == HID_USAGE_DESKTOP_X) return HID_FIELD_X;
+        if (usage == HID_USAGE_DESKTOP_Y) return HID_FIELD_Y;
+        if (usage == HID_USAGE_DESKTOP_WHEEL) return HID_FIELD_WHEEL;
+        break;
+    case HID_USAGE_PAGE_CONSUMER:
+        if (usage == HID_USAGE_CONSUMER_AC_PAN) return HID_FIELD_PAN;
+        break;
+    default:
+        break;
+    }
+    return -1;
+}
+
+static void record_field(hid_field_t *field, uint8_t max_button_bits, uint16_t bit_offset,
+                         const hid_global_state_t *global, uint16_t page, uint16_t usage)
+{
+    if (max_button_bits != 0) {
+
+        if (global->report_size != 1) {
+            return;
+        }
+        if (field->bit_size == 0) {
+            field->bit_offset = bit_offset;
+            field->bit_size = 1;
+            field->usage_page = page;
+            field->usage = usage;
+        } else if (field->bit_offset + field->bit_size == bit_offset && field->bit_size < max_button_bits) {
+            field->bit_size++;
+        }
+        field->logical_min = 0;
+        field->logical_max = 1;
+        return;
+    }
+
+    if (field->bit_size != 0) {
+        return; // First occurrence wins
+    }
+    field->bit_offset = bit_offset;
+    field->bit_size = (uint8_t)global->report_size;
+    field->logical_min = global->logical_min;
+    field->logical_max = global->logical_max;
+    field->usage_page = page;
+    field->usage = usage;
+}
+
+static void record_input_field(hid_report_layout_t *layout, int role, uint16_t bit_offset,
+                               const hid_global_state_t *global, uint16_t page, uint16_t usage)
+{
+    record_field(&layout->fields[role], role == HID_FIELD_BUTTONS ? HID_MAX_BUTTON_BITS : 0,
+                 bit_offset, global, page, usage);
+}
+
+static bool is_gamepad_application(uint32_t application)
+{
+    return application == (((uint32_t)HID_USAGE_PAGE_DESKTOP << 16) | HID_USAGE_DESKTOP_JOYSTICK) ||
+           application == (((uint32_t)HID_USAGE_PAGE_DESKTOP << 16) | HID_USAGE_DESKTOP_GAMEPAD);
+}
+
+// Only the first gamepad report is kept; a second one on another ID is ignored
+static void record_gamepad_field(hid_gamepad_layout_t *gamepad, uint16_t bit_offset,
+                                 const hid_global_state_t *global, uint16_t page, uint16_t usage)
+{
+    if (gamepad->present && gamepad->report_id != global->report_id) {
+        return;
+    }
+
+    hid_field_t *field = NULL;
+    uint8_t max_button_bits = 0;
+    if (page == HID_USAGE_PAGE_BUTTON) {
+        field = &gamepad->buttons;
+        max_button_bits = HID_PLAN_MAX_PAD_BUTTONS;
+    } else if (page == HID_USAGE_PAGE_DESKTOP && usage >= HID_USAGE_DESKTOP_X &&
+               usage < HID_USAGE_DESKTOP_X + HID_PLAN_MAX_AXES) {
+        field = &gamepad->axes[usage - HID_USAGE_DESKTOP_X];
+    } else if (page == HID_USAGE_PAGE_DESKTOP && usage == HID_USAGE_DESKTOP_HAT_SWITCH) {
+        field = &gamepad->hat;
+    }
+    if (field == NULL) {
+        return;
+    }
+
+    gamepad->present = true;
+    gamepad->report_id = global->report_id;
+    record_field(field, max_button_bits, bit_offset, global, page, usage);
+}
+
+static void record_key_field(hid_report_layout_t *layout, uint16_t bit_offset, const hid_global_state_t *global,
+                             const hid_local_state_t *local, bool variable)
+{
+    uint32_t const first = local_usage_at(local, 0);
+    hid_key_field_t key = {
+        .bit_offset = bit_offset,
+        .count = (uint16_t)global->report_count,
+        .bit_size = (uint8_t)global->report_size,
+        .usage_first = (uint8_t)((first & 0xFFFFu) > 0xFFu ? 0xFFu : first),
+        .logical_min = global->logical_min,
+        .logical_max = global->logical_max,
+    };
+
+    if (variable) {
+        if (key.bit_size != 1) {
+            return;
+        }
+        for (uint8_t i = 0; i < HID_PLAN_MAX_KEY_BITMAPS; i++) {
+            if (layout->key_bitmaps[i].count == 0) {
+                layout->key_bitmaps[i] = key;
+                return;
+            }
+        }
+        return;
+    }
+
+    if (layout->key_array.count == 0 && key.bit_size > 0 && key.bit_size <= 8) {
+        layout->key_array = key;
+    }
+}
+
+static void compile_key_field(hid_key_field_t *key, uint16_t id_bits)
+{
+    if (key->count == 0) {
+        return;
+    }
+
+    key->bit_offset = (uint16_t)(key->bit_offset + id_bits);
+    uint32_t const limit = HID_PLAN_MAX_REPORT_BYTES * 8u;
+    uint32_t const end = key->bit_offset + (uint32_t)key->count * key->bit_size;
+    if (key->bit_offset >= limit) {
+        memset(key, 0, sizeof(*key));
+    } else if (end > limit) {
+        key->count = (uint16_t)((limit - key->bit_offset) / key->bit_size);
+    }
+}
+
+static void compile_field(hid_field_t *field, uint16_t id_bits)
+{
+    uint8_t const size = field->bit_size;
+    uint16_t const bit_offset = (uint16_t)(field->bit_offset + id_bits);
+    uint8_t const shift = bit_offset & 7u;
+    uint8_t const byte_offset = (uint8_t)(bit_offset >> 3);
+    uint8_t const span = (uint8_t)((shift + size + 7u) / 8u);
+
+    if (size == 0 || size > 32 || shift + size > 32 ||
+        (bit_offset >> 3) + span > HID_PLAN_MAX_REPORT_BYTES) {
+        memset(field, 0, sizeof(*field));
+        return;
+    }
+
+    field->bit_offset = bit_offset;
+    field->byte_offset = byte_offset;
+    field->bit_shift = shift;
+    field->byte_span = span;
+    field->mask = (size == 32) ? 0xFFFFFFFFu : ((1u << size) - 1u);
+    field->sign_shift = (field->logical_min < 0) ? (uint8_t)(32u - size) : 0u;
+}
+
+static uint16_t *feature_cursor(hid_feature_bits_t *features, uint8_t report_id)
+{
+    for (uint8_t i = 0; i < features->count; i++) {
+        if (features->report_ids[i] == report_id) {
+            return &features->bits[i];
+        }
+    }
+    if (features->count >= HID_PLAN_MAX_REPORTS) {
+        return NULL;
+    }
+    features->report_ids[features->count] = report_id;
+    features->bits[features->count] = 0;
+    return &features->bits[features->count++];
+}
+
+static void record_multipliers(hid_report_plan_t *plan, hid_feature_bits_t *features,
+                               const hid_global_state_t *global, const hid_local_state_t *local)
+{
+    uint16_t *cursor = feature_cursor(features, global->report_id);
+    if (cursor == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < global->report_count; i++) {
+        uint32_t const usage = local_usage_at(local, i);
+        if (usage != (((uint32_t)HID_USAGE_PAGE_DESKTOP << 16) | HID_USAGE_DESKTOP_RESOLUTION_MULTIPLIER) ||
+            plan->multiplier_count >= HID_PLAN_MAX_MULTIPLIERS || global->report_size > 8) {
+            continue;
+        }
+
+        hid_multiplier_t *multiplier = &plan->multipliers[plan->multiplier_count++];
+        memset(multiplier, 0, sizeof(*multiplier));
+        multiplier->field.bit_offset = (uint16_t)(*cursor + i * global->report_size);
+        multiplier->field.bit_size = (uint8_t)global->report_size;
+        multiplier->field.logical_min = global->logical_min;
+        multiplier->field.logical_max = global->logical_max;
+        multiplier->report_id = global->report_id;
+
+
+        bool const has_physical = global->physical_min != 0 || global->physical_max != 0;
+        multiplier->physical_min = has_physical ? global->physical_min : global->logical_min;
+        multiplier->physical_max = has_physical ? global->physical_max : global->logical_max;
+    }
+    *cursor = (uint16_t)(*cursor + global->report_size * global->report_count);
+}
+
+static void compile_multipliers(hid_report_plan_t *plan, hid_feature_bits_t *features)
+{
+    uint16_t const id_bits = plan->uses_report_ids ? 8u : 0u;
+
+    for (uint8_t i = 0; i < plan->multiplier_count; i++) {
+        hid_multiplier_t *multiplier = &plan->multipliers[i];
+        uint16_t const *bits = feature_cursor(features, multiplier->report_id);
+        compile_field(&multiplier->field, id_bits);
+        multiplier->report_bytes = (uint8_t)(id_bits / 8u + (bits ? (*bits + 7u) / 8u : 0u));
+        if (multiplier->field.bit_size == 0 || multiplier->report_bytes > HID_PLAN_MAX_REPORT_BYTES) {
+            plan->multiplier_count = i; // Out of reach; this one and any after it are dropped
+            return;
+        }
+    }
+}
+
+// After compile_plan, which has sized every report
+static void compile_gamepad(hid_report_plan_t *plan)
+{
+    hid_gamepad_layout_t *gamepad = &plan->gamepad;
+    if (!gamepad->present) {
+        return;
+    }
+
+    uint16_t const id_bits = plan->uses_report_ids ? 8u : 0u;
+    for (uint8_t i = 0; i < HID_PLAN_MAX_AXES; i++) {
+        compile_field(&gamepad->axes[i], id_bits);
+    }
+    compile_field(&gamepad->hat, id_bits);
+    compile_field(&gamepad->buttons, id_bits);
+
+    for (uint8_t r = 0; r < plan->report_count; r++) {
+        if (plan->reports[r].report_id == gamepad->report_id) {
+            gamepad->report_bytes = plan->reports[r].report_bytes;
+        }
+    }
+}
+
+static void compile_plan(hid_report_plan_t *plan, const uint16_t *input_bits)
+{
+    uint16_t const id_bits = plan->uses_report_ids ? 8u : 0u;
+
+    for (uint8_t r = 0; r < plan->report_count; r++) {
+        hid_report_layout_t *layout = &plan->reports[r];
+        for (int f = 0; f < HID_FIELD_COUNT; f++) {
+            compile_field(&layout->fields[f], id_bits);
+        }
+        for (uint8_t k = 0; k < HID_PLAN_MAX_KEY_BITMAPS; k++) {
+            compile_key_field(&layout->key_bitmaps[k], id_bits);
+        }
+        compile_key_field(&layout->key_array, id_bits);
+
+        uint32_t bytes = (id_bits / 8u) + ((uint32_t)input_bits[r] + 7u) / 8u;
+        layout->report_bytes = (uint8_t)(bytes > 255u ? 255u : bytes);
+        layout->has_pointer = layout->fields[HID_FIELD_X].bit_size != 0 ||
+                              layout->fields[HID_FIELD_Y].bit_size != 0 ||
+                              layout->fields[HID_FIELD_BUTTONS].bit_size != 0;
+        layout->has_keyboard = layout->key_bitmaps[0].count != 0 || layout->key_array.count != 0;
+    }
+}
+
+bool hid_parse_report_descriptor(const uint8_t *desc, uint16_t desc_len, hid_report_plan_t *plan)
+{
+    if (!desc || !plan) {
+        return false;
+    }
+
+    memset(plan, 0, sizeof(*plan));
+
+    uint16_t input_bits[HID_PLAN_MAX_REPORTS] = {0};
+    hid_feature_bits_t features = {};
+    hid_global_state_t global = {0};
+    hid_global_state_t stack[HID_PARSER_STACK_DEPTH];
+    uint8_t stack_depth = 0;
+    hid_local_state_t local = {0};
+    uint32_t application = 0;       // Usage of the enclosing top-level collection
+
+    const uint8_t *p = desc;
+    const uint8_t *const end = desc + desc_len;
+
+    while (p < end) {
+        uint8_t const prefix = *p++;
+
+        if (prefix == HID_ITEM_LONG_PREFIX) {
+            if (end - p < 2) {
+                break;
+            }
+            p += 2 + p[0];
+            continue;
+        }
+
+        static const uint8_t size_table[4] = {0, 1, 2, 4};
+        uint8_t const size = size_table[prefix & 0x03];
+        uint8_t const type = (prefix >> 2) & 0x03;
+        uint8_t const tag = prefix >> 4;
+
+        if (end - p < size) {
+            break;
+        }
+
+        uint32_t udata = 0;
+        for (uint8_t i = 0; i < size; i++) {
+            udata |= (uint32_t)p[i] << (8u * i);
+        }
+        int32_t sdata = (int32_t)udata;
+        if (size == 1) sdata = (int8_t)udata;
+        else if (size == 2) sdata = (int16_t)udata;
+        p += size;
+
+        switch (type) {
+        case HID_ITEM_TYPE_GLOBAL:
+            switch (tag) {
+            case HID_GLOBAL_USAGE_PAGE:   global.usage_page = (uint16_t)udata; break;
+            case HID_GLOBAL_LOGICAL_MIN:  global.logical_min = sdata; break;
+            case HID_GLOBAL_LOGICAL_MAX:
+
+                global.logical_max = (global.logical_min >= 0 && sdata < global.logical_min) ? (int32_t)udata : sdata;
+                break;
+            case HID_GLOBAL_PHYSICAL_MIN: global.physical_min = sdata; break;
+            case HID_GLOBAL_PHYSICAL_MAX:
+                global.physical_max = (global.physical_min >= 0 && sdata < global.physical_min) ? (int32_t)udata : sdata;
+                break;
+            case HID_GLOBAL_REPORT_SIZE:  global.report_size = udata; break;
+            case HID_GLOBAL_REPORT_COUNT: global.report_count = udata; break;
+            case HID_GLOBAL_REPORT_ID:
+                global.report_id = (uint8_t)udata;
+                plan->uses_report_ids = true;
+                break;
+            case HID_GLOBAL_PUSH:
+                if (stack_depth < HID_PARSER_STACK_DEPTH) stack[stack_depth++] = global;
+                break;
+            case HID_GLOBAL_POP:
+                if (stack_depth > 0) global = stack[--stack_depth];
+                break;
+            default:
+                break;
+            }
+            break;
+
+        case HID_ITEM_TYPE_LOCAL:
+        {
+
+            uint32_t const usage = (size == 4) ? udata : (((uint32_t)global.usage_page << 16) | (udata & 0xFFFFu));
+            switch (tag) {
+            case HID_LOCAL_USAGE:
+                if (local.usage_count < HID_PARSER_MAX_USAGES) local.usages[local.usage_count++] = usage;
+                break;
+            case HID_LOCAL_USAGE_MIN:
+                local.usage_min = usage;
+                local.has_range = true;
+                break;
+            case HID_LOCAL_USAGE_MAX:
+                local.usage_max = usage;
+                local.has_range = true;
+                break;
+            default:
+                break;
+            }
+            break;
+        }
+
+        case HID_ITEM_TYPE_MAIN:
+            if (tag == HID_MAIN_INPUT) {
+                hid_report_layout_t *layout = plan_get_report(plan, input_bits, global.report_id);
+                if (layout) {
+                    uint16_t *cursor = &input_bits[layout - plan->reports];
+                    bool const is_data_variable = !(udata & HID_INPUT_CONSTANT) && (udata & HID_INPUT_VARIABLE);
+
+                    bool const is_keyboard = !(udata & HID_INPUT_CONSTANT) &&
+                                             (local_usage_at(&local, 0) >> 16) == HID_USAGE_PAGE_KEYBOARD;
+
+                    if (is_keyboard) {
+                        record_key_field(layout, *cursor, &global, &local, is_data_variable);
+                    }
+                    bool const is_gamepad = is_gamepad_application(application);
+                    for (uint32_t i = 0; is_data_variable && !is_keyboard && i < global.report_count; i++) {
+                        uint32_t const usage = local_usage_at(&local, i);
+                        uint16_t const page = (uint16_t)(usage >> 16);
+                        int const role = role_for_usage(page, (uint16_t)usage);
+                        if (is_gamepad) {
+                            record_gamepad_field(&plan->gamepad, (uint16_t)(*cursor + i * global.report_size),
+                                                 &global, page, (uint16_t)usage);
+                        } else if (role >= 0) {
+                            record_input_field(layout, role, (uint16_t)(*cursor + i * global.report_size),
+                                               &global, page, (uint16_t)usage);
+                        }
+                    }
+                    *cursor = (uint16_t)(*cursor + global.report_size * global.report_count);
+                }
+            } else if (tag == HID_MAIN_OUTPUT && !plan->has_leds &&
+                       (local_usage_at(&local, 0) >> 16) == HID_USAGE_PAGE_LED) {
+                plan->has_leds = true;
+                plan->led_report_id = global.report_id;
+            } else if (tag == HID_MAIN_FEATURE) {
+                record_multipliers(plan, &features, &global, &local);
+            } else if (tag == HID_MAIN_COLLECTION && udata == HID_COLLECTION_APPLICATION) {
+                application = local_usage_at(&local, 0);
+            }
+            memset(&local, 0, sizeof(local));
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    compile_plan(plan, input_bits);
+    compile_multipliers(plan, &features);
+    compile_gamepad(plan);
+    return plan->report_count > 0;
+}
+
+void hid_report_plan_init_boot_mouse(hid_report_plan_t *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+
+    hid_report_layout_t *layout = &plan->reports[0];
+    plan->report_count = 1;
+
+    layout->fields[HID_FIELD_BUTTONS] = (hid_field_t){ .bit_offset = 0,  .bit_size = 8, .logical_min = 0, .logical_max = 1,
+                                                       .usage_page = HID_USAGE_PAGE_BUTTON, .usage = 1 };
+    layout->fields[HID_FIELD_X]       = (hid_field_t){ .bit_offset = 8,  .bit_size = 8, .logical_min = -127, .logical_max = 127,
+                                                       .usage_page = HID_USAGE_PAGE_DESKTOP, .usage = HID_USAGE_DESKTOP_X };
+    layout->fields[HID_FIELD_Y]       = (hid_field_t){ .bit_offset = 16, .bit_size = 8, .logical_min = -127, .logical_max = 127,
+                                                       .usage_page = HID_USAGE_PAGE_DESKTOP, .usage = HID_USAGE_DESKTOP_Y };
+    layout->fields[HID_FIELD_WHEEL]   = (hid_field_t){ .bit_offset = 24, .bit_size = 8, .logical_min = -127, .logical_max = 127,
+                                                       .usage_page = HID_USAGE_PAGE_DESKTOP, .usage = HID_USAGE_DESKTOP_WHEEL };
+
+    uint16_t const input_bits[HID_PLAN_MAX_REPORTS] = {32};
+    compile_plan(plan, input_bits);
+}
+
+void hid_report_plan_init_boot_keyboard(hid_report_plan_t *plan)
+{
+    memset(plan, 0, sizeof(*plan));
+
+    hid_report_layout_t *layout = &plan->reports[0];
+    plan->report_count = 1;
+
+    layout->key_bitmaps[0] = (hid_key_field_t){ .bit_offset = 0, .count = 8, .bit_size = 1, .usage_first = HID_KEY_CONTROL_LEFT,
+                                                .logical_min = 0, .logical_max = 1 };
+    layout->key_array      = (hid_key_field_t){ .bit_offset = 16, .count = 6, .bit_size = 8, .usage_first = 0,
+                                                .logical_min = 0, .logical_max = 255 };
+
+    uint16_t const input_bits[HID_PLAN_MAX_REPORTS] = {64};
+    compile_plan(plan, input_bits);
+    plan->has_leds = true;
+}
+
+bool hid_report_plan_has_pointer(const hid_report_plan_t *plan)
+{
+    for (uint8_t i = 0; i < plan->report_count; i++) {
+        if (plan->reports[i].has_pointer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool hid_report_plan_has_keyboard(const hid_report_plan_t *plan)
+{
+    for (uint8_t i = 0; i < plan->report_count; i++) {
+        if (plan->reports[i].has_keyboard) {
+            return true;
+        }
+    }
+    return false;
+}
+
+const hid_report_layout_t *hid_report_plan_find(const hid_report_plan_t *plan, const uint8_t *report, uint16_t len)
+{
+    if (!plan || !report || len == 0 || plan->report_count == 0) {
+        return NULL;
+    }
+    if (!plan->uses_report_ids) {
+        return &plan->reports[0];
+    }
+
+    uint8_t const report_id = report[0];
+    for (uint8_t i = 0; i < plan->report_count; i++) {
+        if (plan->reports[i].report_id == report_id) {
+            return &plan->reports[i];
+        }
+    }
+    return NULL;
+}
+
+void hid_field_get_range(const hid_field_t *field, int32_t *min, int32_t *max)
+{
+    if (field->bit_size == 0) {
+        *min = 0;
+        *max = 0;
+        return;
+    }
+    if (field->logical_min < field->logical_max) {
+        *min = field->logical_min;
+        *max = field->logical_max;
+        return;
+    }
+
+
+    if (field->sign_shift != 0) {
+        *max = (int32_t)(field->mask >> 1);
+        *min = -*max;
+    } else {
+        *min = 0;
+        *max = (field->mask > (uint32_t)INT32_MAX) ? INT32_MAX : (int32_t)field->mask;
+    }
+}
+
+static uint8_t multiplier_resolution(const hid_multiplier_t *multiplier, int32_t value)
+{
+    hid_field_t const *field = &multiplier->field;
+    int32_t resolution = multiplier->physical_min;
+    if (field->logical_max > field->logical_min) {
+        if (value < field->logical_min) value = field->logical_min;
+        if (value > field->logical_max) value = field->logical_max;
+        resolution += (value - field->logical_min) * (multiplier->physical_max - multiplier->physical_min) /
+                      (field->logical_max - field->logical_min);
+    }
+    return (uint8_t)(resolution < 1 ? 1 : (resolution > 255 ? 255 : resolution));
+}
+
+bool hid_multiplier_decode(const hid_report_plan_t *plan, const uint8_t *report, uint16_t len,
+                           uint8_t *wheel, uint8_t *pan)
+{
+    uint8_t resolution[HID_PLAN_MAX_MULTIPLIERS] = {0};
+    bool found = false;
+
+    for (uint8_t i = 0; i < plan->multiplier_count; i++) {
+        hid_multiplier_t const *multiplier = &plan->multipliers[i];
+        if (len < multiplier->report_bytes || (plan->uses_report_ids && report[0] != multiplier->report_id)) {
+            continue;
+        }
+        resolution[i] = multiplier_resolution(multiplier, hid_field_extract(report, &multiplier->field));
+        found = true;
+    }
+    if (!found) {
+        return false;
+    }
+
+    // A single multiplier covers the pan as well
+    *wheel = resolution[0] ? resolution[0] : 1;
+    *pan = (plan->multiplier_count > 1 && resolution[1]) ? resolution[1] : *wheel;
+    return true;
+}
+
+uint16_t hid_multiplier_build(const hid_report_plan_t *plan, bool high, uint8_t *report)
+{
+    if (plan->multiplier_count == 0) {
+        return 0;
+    }
+
+    uint8_t const report_id = plan->multipliers[0].report_id;
+    uint16_t len = 0;
+    memset(report, 0, HID_PLAN_MAX_REPORT_BYTES);
+    report[0] = report_id;
+
+    for (uint8_t i = 0; i < plan->multiplier_count; i++) {
+        hid_multiplier_t const *multiplier = &plan->multipliers[i];
+        if (multiplier->report_id != report_id) {
+            continue;
+        }
+        hid_field_insert(report, &multiplier->field,
+                         high ? multiplier->field.logical_max : multiplier->field.logical_min);
+        if (multiplier->report_bytes > len) {
+            len = multiplier->report_bytes;
+        }
+    }
+    return len;
+}
@@ -0,0 +1,196 @@
+/*
+ * Hurricane vbox Firmware
+ */
+
+#include "identity_cache.h"
+#include "defines.h"
+#include "tusb.h"
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+#include <string.h>
+
+
+#define IDENTITY_CACHE_MAGIC    0x56424944u     // "VBID"
+#define IDENTITY_CACHE_OFFSET   (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+
+
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;                  // Highest is the most recently stored
+    device_identity_t identity;
+    uint32_t crc;                       // Over sequence and identity
+} identity_cache_entry_t;
+
+typedef union {
+    identity_cache_entry_t entries[IDENTITY_CACHE_ENTRIES];
+    uint8_t bytes[FLASH_SECTOR_SIZE];
+} identity_cache_sector_t;
+
+static_assert(sizeof(identity_cache_entry_t) * IDENTITY_CACHE_ENTRIES <= FLASH_SECTOR_SIZE,
+              "Cache entries must fit one flash sector");
+
+
+// RAM copy of the sector; lookups never touch flash
+static identity_cache_sector_t cache_image;
+static identity_cache_stats_t cache_stats;
+
+
+static uint32_t crc32(const uint8_t *data, size_t len)
+{
+    uint32_t crc = 0xFFFFFFFFu;
+    while (len--) {
+        crc ^= *data++;
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1u)));
+        }
+    }
+    return ~crc;
+}
+
+static uint32_t entry_crc(const identity_cache_entry_t *entry)
+{
+    return crc32((const uint8_t *)&entry->sequence,
+                 offsetof(identity_cache_entry_t, crc) - offsetof(identity_cache_entry_t, sequence));
+}
+
+static identity_cache_entry_t *newest_entry(void)
+{
+    identity_cache_entry_t *newest = NULL;
+    for (uint8_t i = 0; i < IDENTITY_CACHE_ENTRIES; i++) {
+        identity_cache_entry_t *entry = &cache_image.entries[i];
+        if (entry->magic == IDENTITY_CACHE_MAGIC && (newest == NULL || entry->sequence > newest->sequence)) {
+            newest = entry;
+        }
+    }
+    return newest;
+}
+
+static void program_cache_sector(void *param)
+{
+    (void)param;
+    flash_range_erase(IDENTITY_CACHE_OFFSET, FLASH_SECTOR_SIZE);
+    flash_range_program(IDENTITY_CACHE_OFFSET, cache_image.bytes, FLASH_SECTOR_SIZE);
+}
+
+void identity_cache_init(void)
+{
+    memcpy(&cache_image, (const void *)(XIP_BASE + IDENTITY_CACHE_OFFSET), sizeof(cache_image));
+    memset(&cache_stats, 0, sizeof(cache_stats));
+
+    for (uint8_t i = 0; i < IDENTITY_CACHE_ENTRIES; i++) {
+        identity_cache_entry_t *entry = &cache_image.entries[i];
+        if (entry->magic == IDENTITY_CACHE_MAGIC && entry->crc == entry_crc(entry)) {
+            cache_stats.valid_entries++;
+        } else {
+            memset(entry, 0, sizeof(*entry));   // Erased flash or an interrupted write
+        }
+    }
+}
+
+const device_identity_t *identity_cache_last(void)
+{
+    identity_cache_entry_t const *entry = newest_entry();
+    return entry != NULL ? &entry->identity : NULL;
+}
+
+const device_identity_t *identity_cache_find(uint16_t vid, uint16_t pid)
+{
+    for (uint8_t i = 0; i < IDENTITY_CACHE_ENTRIES; i++) {
+        identity_cache_entry_t const *entry = &cache_image.entries[i];
+        if (entry->magic == IDENTITY_CACHE_MAGIC && entry->identity.vid == vid && entry->identity.pid == pid) {
+            cache_stats.hits++;
+            return &entry->identity;
+        }
+    }
+    cache_stats.misses++;
+    return NULL;
+}
+
+bool identity_cache_store(const device_identity_t *identity)
+{
+    identity_cache_entry_t *newest = newest_entry();
+    if (newest != NULL && memcmp(&newest->identity, identity, sizeof(*identity)) == 0) {
+        return true;
+    }
+
+
+    // Same VID/PID first, then a free entry, then the oldest one
+    identity_cache_entry_t *target = NULL;
+    identity_cache_entry_t *free_entry = NULL;
+    identity_cache_entry_t *oldest = NULL;
+    for (uint8_t i = 0; i < IDENTITY_CACHE_ENTRIES; i++) {
+        identity_cache_entry_t *entry = &cache_image.entries[i];
+        if (entry->magic != IDENTITY_CACHE_MAGIC) {
+            if (free_entry == NULL) {
+                free_entry = entry;
+            }
+            continue;
+        }
+        if (entry->identity.vid == identity->vid && entry->identity.pid == identity->pid) {
+            target = entry;
+            break;
+        }
+        if (oldest == NULL || entry->sequence < oldest->sequence) {
+            oldest = entry;
+        }
+    }
+    if (target == NULL) {
+        target = free_entry != NULL ? free_entry : oldest;
+    }
+
+    identity_cache_entry_t const previous = *target;
+    target->magic = IDENTITY_CACHE_MAGIC;
+    target->sequence = newest != NULL ? newest->sequence + 1 : 1;
+    target->identity = *identity;
+    target->crc = entry_crc(target);
+
+    uint32_t const start_us = time_us_32();
+    int const result = flash_safe_execute(program_cache_sector, NULL, IDENTITY_CACHE_LOCKOUT_TIMEOUT_MS);
+    cache_stats.last_write_us = time_us_32() - start_us;
+    if (cache_stats.last_write_us > cache_stats.max_write_us) {
+        cache_stats.max_write_us = cache_stats.last_write_us;
+    }
+
+    if (result != PICO_OK) {
+        *target = previous;
+        cache_stats.write_failures++;
+        return false;
+    }
+    cache_stats.writes++;
+    return true;
+}
+
+void identity_cache_get_stats(identity_cache_stats_t *stats)
+{
+    if (stats) {
+        *stats = cache_stats;
+    }
+}
+
+void identity_encode_string(const char *str, uint16_t *desc)
+{
+    memset(desc, 0, IDENTITY_STRING_UNITS * sizeof(uint16_t));
+
+    uint8_t count = 0;
+    while (str != NULL && str[count] != '\0' && count < IDENTITY_STRING_UNITS - 1) {
+        desc[1 + count] = (uint8_t)str[count];
+        count++;
+    }
+    desc[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 + 2 * count));
+}
+
+void identity_copy_string(const uint16_t *src, size_t src_bytes, uint16_t *desc)
+{
+    memset(desc, 0, IDENTITY_STRING_UNITS * sizeof(uint16_t));
+
+    const uint8_t *raw = (const uint8_t *)src;
+    if (src_bytes < 2 || raw[0] < 2 || raw[1] != TUSB_DESC_STRING) {
+        return; // Not a string descriptor; leave it absent
+    }
+
+    size_t const len = TU_MIN((size_t)raw[0], src_bytes);
+    size_t const units = TU_MIN((len - 2) / 2, (size_t)(IDENTITY_STRING_UNITS - 1));
+    memcpy(&desc[1], &src[1], units * sizeof(uint16_t));
+    desc[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 + 2 * units));
+}
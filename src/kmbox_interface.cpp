@@ -1,10 +1,11 @@
 /*
  * KMBox Interface Implementation
- * 
+ *
  * UART-only interface implementation
  */
 
 #include "kmbox_interface.h"
+#include "defines.h"
 #include "pico/stdlib.h"
 #include "hardware/uart.h"
 
@@ -15,9 +16,9 @@
 
 
 const kmbox_uart_config_t KMBOX_UART_DEFAULT_CONFIG = {
-    .baudrate = 250000,
-    .tx_pin = 4,
-    .rx_pin = 5,
+    .baudrate = KMBOX_UART_BAUDRATE,
+    .tx_pin = KMBOX_UART_TX_PIN,
+    .rx_pin = KMBOX_UART_RX_PIN,
     .use_dma = true
 };
 
@@ -27,42 +28,45 @@ const kmbox_uart_config_t KMBOX_UART_DEFAULT_CONFIG = {
 #define TX_BUFFER_SIZE 1024
 #define RX_BUFFER_MASK (RX_BUFFER_SIZE - 1)
 #define TX_BUFFER_MASK (TX_BUFFER_SIZE - 1)
+#define RX_DMA_TRANSFER_COUNT 0xFFFFu   // Bytes per RX DMA run before the IRQ re-arms it
 
 
-_Static_assert((RX_BUFFER_SIZE & (RX_BUFFER_SIZE - 1)) == 0,
-               "RX_BUFFER_SIZE must be a power of two");
-_Static_assert((TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) == 0,
-               "TX_BUFFER_SIZE must be a power of two");
+static_assert((RX_BUFFER_SIZE & (RX_BUFFER_SIZE - 1)) == 0,
+              "RX_BUFFER_SIZE must be a power of two");
+static_assert((TX_BUFFER_SIZE & (TX_BUFFER_SIZE - 1)) == 0,
+              "TX_BUFFER_SIZE must be a power of two");
 
 
 typedef struct {
 
     kmbox_interface_config_t config;
-    
+
 
     uart_inst_t* uart;
-    
+
 
     uint8_t __attribute__((aligned(RX_BUFFER_SIZE))) rx_buffer[RX_BUFFER_SIZE];
     uint8_t __attribute__((aligned(TX_BUFFER_SIZE))) tx_buffer[TX_BUFFER_SIZE];
-    
+
 
     volatile uint16_t rx_head;
     volatile uint16_t rx_tail;
     volatile uint16_t tx_head;
     volatile uint16_t tx_tail;
-    
+    uint16_t tx_in_flight;              // Bytes from tx_tail the TX channel is sending
+    uint32_t rx_read_total;             // Bytes consumed or skipped, for spotting a lapped ring
+    volatile uint32_t rx_irqs;          // Written by the DMA IRQ
+
 
     int dma_rx_chan;
     int dma_tx_chan;
-    
+
 
     kmbox_interface_stats_t stats;
-    
+
 
     bool initialized;
-    bool tx_in_progress;
-    
+
 
 } kmbox_interface_state_t;
 
@@ -77,6 +81,8 @@ static kmbox_interface_state_t g_interface = {
 static bool init_uart(const kmbox_uart_config_t* config);
 static void process_uart(void);
 static void uart_dma_rx_setup(void);
+static void uart_dma_tx_setup(void);
+static void uart_tx_kick(void);
 static void dma_rx_irq_handler(void);
 
 
@@ -85,57 +91,70 @@ bool kmbox_interface_init(const kmbox_interface_config_t* config)
     if (!config || g_interface.initialized) {
         return false;
     }
-    
+
 
     memset(&g_interface, 0, sizeof(g_interface));
     g_interface.dma_rx_chan = -1;
     g_interface.dma_tx_chan = -1;
-    
+
 
     g_interface.config = *config;
-    
+
 
     bool success = false;
     if (config->transport_type != KMBOX_TRANSPORT_UART) {
         return false;
     }
     success = init_uart(&config->config.uart);
-    
+
     if (success) {
         g_interface.initialized = true;
     }
-    
+
     return success;
 }
 
 
-static bool init_uart(const kmbox_uart_config_t* config)
+// UART functions repeat in groups of four GPIOs (TX, RX, CTS, RTS), switching
+// UART every eight pins from GPIO 4: 0-3 UART0, 4-11 UART1, 12-19 UART0, ...
+static uart_inst_t* uart_for_pins(unsigned int tx_pin, unsigned int rx_pin)
 {
+    if (tx_pin >= NUM_BANK0_GPIOS || rx_pin >= NUM_BANK0_GPIOS || (tx_pin & 3u) != 0 || (rx_pin & 3u) != 1) {
+        return NULL;
+    }
 
-    if (config->tx_pin == 0 && config->rx_pin == 1) {
-        g_interface.uart = uart0;
-    } else if (config->tx_pin == 4 && config->rx_pin == 5) {
-        g_interface.uart = uart1;
-    } else {
+    unsigned int const index = ((tx_pin + 4u) >> 3) & 1u;
+    if ((((rx_pin + 4u) >> 3) & 1u) != index) {
+        return NULL;
+    }
+    return index ? uart1 : uart0;
+}
+
+static bool init_uart(const kmbox_uart_config_t* config)
+{
+    g_interface.uart = uart_for_pins(config->tx_pin, config->rx_pin);
+    if (g_interface.uart == NULL) {
         return false;
     }
-    
+
 
     uart_init(g_interface.uart, config->baudrate);
 
 
     gpio_set_function(config->tx_pin, GPIO_FUNC_UART);
     gpio_set_function(config->rx_pin, GPIO_FUNC_UART);
-    
+    gpio_pull_up(config->rx_pin); // Help avoid spurious RX when line idle/floating
+
 
     uart_set_format(g_interface.uart, 8, 1, UART_PARITY_NONE);
     uart_set_fifo_enabled(g_interface.uart, true);
-    
+
 
     if (config->use_dma) {
         uart_dma_rx_setup();
+        uart_dma_tx_setup();
     }
-    
+
     return true;
 }
 
@@ -145,35 +164,59 @@ static bool init_uart(const kmbox_uart_config_t* config)
 static void uart_dma_rx_setup(void)
 {
     g_interface.dma_rx_chan = dma_claim_unused_channel(true);
-    
+
     dma_channel_config c = dma_channel_get_default_config(g_interface.dma_rx_chan);
     channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
     channel_config_set_read_increment(&c, false);
     channel_config_set_write_increment(&c, true);
     channel_config_set_dreq(&c, uart_get_dreq(g_interface.uart, false));
     channel_config_set_ring(&c, true, __builtin_ctz(RX_BUFFER_SIZE));
-    
+
     dma_channel_configure(
         g_interface.dma_rx_chan,
         &c,
-    g_interface.rx_buffer,
-    &uart_get_hw(g_interface.uart)->dr,
-        0xFFFF,
+        g_interface.rx_buffer,
+        &uart_get_hw(g_interface.uart)->dr,
+        RX_DMA_TRANSFER_COUNT,
         true
     );
-    
+
     dma_channel_set_irq1_enabled(g_interface.dma_rx_chan, true);
     irq_set_exclusive_handler(DMA_IRQ_1, dma_rx_irq_handler);
     irq_set_enabled(DMA_IRQ_1, true);
 }
 
+static void uart_dma_tx_setup(void)
+{
+    g_interface.dma_tx_chan = dma_claim_unused_channel(true);
+
+    dma_channel_config c = dma_channel_get_default_config(g_interface.dma_tx_chan);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_8);
+    channel_config_set_read_increment(&c, true);
+    channel_config_set_write_increment(&c, false);
+    channel_config_set_dreq(&c, uart_get_dreq(g_interface.uart, true));
+    channel_config_set_ring(&c, false, __builtin_ctz(TX_BUFFER_SIZE));    // Reads wrap at the end of the ring
+
+    dma_channel_configure(
+        g_interface.dma_tx_chan,
+        &c,
+        &uart_get_hw(g_interface.uart)->dr,
+        g_interface.tx_buffer,
+        0,
+        false
+    );
+}
+
 
 
+// The only RX interrupt: one per RX_DMA_TRANSFER_COUNT bytes, where the old
+// FIFO interrupt fired every few bytes
 static void __not_in_flash_func(dma_rx_irq_handler)(void)
 {
-    if (g_interface.dma_rx_chan >= 0) {
+    if (g_interface.dma_rx_chan >= 0 && (dma_hw->ints1 & (1u << g_interface.dma_rx_chan))) {
         dma_hw->ints1 = 1u << g_interface.dma_rx_chan;
-        dma_channel_set_trans_count(g_interface.dma_rx_chan, 0xFFFF, true);
+        dma_channel_set_trans_count(g_interface.dma_rx_chan, RX_DMA_TRANSFER_COUNT, true);
+        g_interface.rx_irqs++;
     }
 }
 
@@ -185,23 +228,48 @@ void kmbox_interface_process(void)
     if (!g_interface.initialized) {
         return;
     }
-    
+
     if (g_interface.config.transport_type == KMBOX_TRANSPORT_UART) {
         process_uart();
+        uart_tx_kick();
     }
 }
 
 
 static void process_uart(void)
 {
+    uart_hw_t* hw = uart_get_hw(g_interface.uart);
+    if (hw->ris & UART_UARTRIS_OERIS_BITS) {
+        hw->icr = UART_UARTICR_OEIC_BITS;
+        g_interface.stats.uart_overruns++;
+    }
+
+
     uint16_t head = g_interface.rx_head;
     uint16_t tail = g_interface.rx_tail;
-    
+
 
     if (g_interface.config.config.uart.use_dma && g_interface.dma_rx_chan >= 0) {
-        uint32_t write_addr = dma_channel_hw_addr(g_interface.dma_rx_chan)->write_addr;
-        uint32_t buffer_start = (uint32_t)g_interface.rx_buffer;
-        head = (write_addr - buffer_start) & RX_BUFFER_MASK;
+        // The write address gives the head; the bytes written so far, from
+        // the transfer count and the re-arms, tell whether it lapped the tail
+        dma_channel_hw_t* chan = dma_channel_hw_addr(g_interface.dma_rx_chan);
+        uint32_t irqs, remaining, write_addr;
+        do {
+            irqs = g_interface.rx_irqs;
+            remaining = chan->transfer_count;
+            write_addr = chan->write_addr;
+        } while (irqs != g_interface.rx_irqs || remaining != chan->transfer_count);
+
+        head = (uint16_t)((write_addr - (uint32_t)(uintptr_t)g_interface.rx_buffer) & RX_BUFFER_MASK);
+        uint32_t const written = irqs * RX_DMA_TRANSFER_COUNT + (RX_DMA_TRANSFER_COUNT - remaining);
+        uint32_t const unread = written - g_interface.rx_read_total;
+        if (unread >= RX_BUFFER_SIZE) {
+            g_interface.stats.rx_overruns++;
+            g_interface.stats.rx_bytes_lost += unread;
+            g_interface.stats.bytes_received += unread;
+            g_interface.rx_read_total = written;
+            tail = head;
+        }
     } else {
 
     while (uart_is_readable(g_interface.uart)) {
@@ -211,51 +279,92 @@ static void process_uart(void)
                 head = next_head;
             } else {
                 uart_getc(g_interface.uart); // Discard
-                g_interface.stats.errors++;
+                g_interface.stats.rx_bytes_lost++;
             }
         }
-        g_interface.rx_head = head;
     }
-    
-
-    while (tail != head) {
-        uint16_t chunk_size;
-        if (head > tail) {
-            chunk_size = head - tail;
-        } else {
-            chunk_size = RX_BUFFER_SIZE - tail;
-        }
-        
-        if (g_interface.config.on_command_received && chunk_size > 0) {
-            g_interface.config.on_command_received(&g_interface.rx_buffer[tail], chunk_size);
-            g_interface.stats.bytes_received += chunk_size;
-        }
-        
-        tail = (tail + chunk_size) & RX_BUFFER_MASK;
-    }
-    
+
+
+    g_interface.rx_head = head;
     g_interface.rx_tail = tail;
 }
 
 
+size_t kmbox_interface_rx_peek(const uint8_t** data)
+{
+    uint16_t const head = g_interface.rx_head;
+    uint16_t const tail = g_interface.rx_tail;
+    *data = &g_interface.rx_buffer[tail];
+    return head >= tail ? (size_t)(head - tail) : (size_t)(RX_BUFFER_SIZE - tail);
+}
+
+
+size_t kmbox_interface_rx_available(void)
+{
+    return (size_t)((g_interface.rx_head - g_interface.rx_tail) & RX_BUFFER_MASK);
+}
+
+
+void kmbox_interface_rx_consume(size_t len)
+{
+    g_interface.rx_tail = (uint16_t)((g_interface.rx_tail + len) & RX_BUFFER_MASK);
+    g_interface.rx_read_total += (uint32_t)len;
+    g_interface.stats.bytes_received += (uint32_t)len;
+}
+
+
 
 
+// Retires the finished transfer, then sends everything queued since in one.
+// Only the main loop touches the TX ring, so it needs no locking.
+static void uart_tx_kick(void)
+{
+    if (g_interface.dma_tx_chan < 0) {
+        // Without DMA the FIFO takes what it has room for; nothing waits
+        while (g_interface.tx_tail != g_interface.tx_head && uart_is_writable(g_interface.uart)) {
+            uart_putc_raw(g_interface.uart, (char)g_interface.tx_buffer[g_interface.tx_tail]);
+            g_interface.tx_tail = (g_interface.tx_tail + 1) & TX_BUFFER_MASK;
+            g_interface.stats.bytes_sent++;
+        }
+        return;
+    }
+
+    if (g_interface.tx_in_flight != 0) {
+        if (dma_channel_is_busy(g_interface.dma_tx_chan)) {
+            return;
+        }
+        g_interface.tx_tail = (g_interface.tx_tail + g_interface.tx_in_flight) & TX_BUFFER_MASK;
+        g_interface.stats.bytes_sent += g_interface.tx_in_flight;
+        g_interface.tx_in_flight = 0;
+    }
+
+    uint16_t const pending = (g_interface.tx_head - g_interface.tx_tail) & TX_BUFFER_MASK;
+    if (pending != 0) {
+        g_interface.tx_in_flight = pending;
+        dma_channel_transfer_from_buffer_now(g_interface.dma_tx_chan, &g_interface.tx_buffer[g_interface.tx_tail], pending);
+    }
+}
+
+
+// All or nothing: half an echo or binary frame is worse than none
 bool kmbox_interface_send(const uint8_t* data, size_t len)
 {
     if (!g_interface.initialized || !data || len == 0) {
         return false;
     }
-    
+
 
     uint16_t head = g_interface.tx_head;
     uint16_t tail = g_interface.tx_tail;
-    uint16_t available = (tail - head - 1) & TX_BUFFER_MASK;
-    
+    uint16_t used = (head - tail) & TX_BUFFER_MASK;
+    uint16_t available = TX_BUFFER_MASK - used;
+
     if (available < len) {
-        g_interface.stats.errors++;
+        g_interface.stats.tx_dropped_writes++;
+        g_interface.stats.tx_dropped_bytes += len;
         return false;
     }
-    
+
 
     size_t first = TX_BUFFER_SIZE - (head & TX_BUFFER_MASK);
     if (first > len) first = len;
@@ -264,16 +373,15 @@ bool kmbox_interface_send(const uint8_t* data, size_t len)
         memcpy(&g_interface.tx_buffer[0], data + first, len - first);
     }
     head = (head + (uint16_t)len) & TX_BUFFER_MASK;
-    
+
     g_interface.tx_head = head;
-    g_interface.stats.bytes_sent += len;
-    
+    if (used + len > g_interface.stats.tx_high_water) {
+        g_interface.stats.tx_high_water = (uint16_t)(used + len);
+    }
 
-    if (!g_interface.tx_in_progress) {
 
-        g_interface.tx_in_progress = true;
-    }
-    
+    uart_tx_kick();
+
     return true;
 }
 
@@ -283,11 +391,11 @@ bool kmbox_interface_is_ready(void)
     if (!g_interface.initialized) {
         return false;
     }
-    
+
     uint16_t head = g_interface.tx_head;
     uint16_t tail = g_interface.tx_tail;
     uint16_t available = (tail - head - 1) & TX_BUFFER_MASK;
-    
+
     return available > 0;
 }
 
@@ -296,6 +404,7 @@ void kmbox_interface_get_stats(kmbox_interface_stats_t* stats)
 {
     if (stats) {
         *stats = g_interface.stats;
+        stats->rx_irqs = g_interface.rx_irqs;
     }
 }
 
@@ -305,23 +414,24 @@ void kmbox_interface_deinit(void)
     if (!g_interface.initialized) {
         return;
     }
-    
+
 
     if (g_interface.dma_rx_chan >= 0) {
+        dma_channel_set_irq1_enabled(g_interface.dma_rx_chan, false);
         dma_channel_abort(g_interface.dma_rx_chan);
         dma_channel_unclaim(g_interface.dma_rx_chan);
     }
-    
+
     if (g_interface.dma_tx_chan >= 0) {
         dma_channel_abort(g_interface.dma_tx_chan);
         dma_channel_unclaim(g_interface.dma_tx_chan);
     }
-    
+
 
     if (g_interface.config.transport_type == KMBOX_TRANSPORT_UART) {
         uart_deinit(g_interface.uart);
     }
-    
+
     g_interface.initialized = false;
 }
 
@@ -329,4 +439,4 @@ void kmbox_interface_deinit(void)
 kmbox_transport_type_t kmbox_interface_get_transport_type(void)
 {
     return g_interface.initialized ? g_interface.config.transport_type : KMBOX_TRANSPORT_NONE;
-}
\ No newline at end of file
+}
@@ -481,14 +481,23 @@ static system_status_t determine_system_status(void)
 #if PIO_USB_AVAILABLE
     const bool host_mounted = tuh_mounted(1);
     const bool mouse_connected = is_mouse_connected();
+    const bool keyboard_connected = is_keyboard_connected();
 
 
     if (device_mounted && host_mounted)
     {
+        if (mouse_connected && keyboard_connected)
+        {
+            return STATUS_BOTH_HID_CONNECTED;
+        }
         if (mouse_connected)
         {
             return STATUS_MOUSE_CONNECTED;
         }
+        if (keyboard_connected)
+        {
+            return STATUS_KEYBOARD_CONNECTED;
+        }
     }
 
     else if (device_mounted)
@@ -502,6 +511,10 @@ static system_status_t determine_system_status(void)
         {
             return STATUS_MOUSE_CONNECTED;
         }
+        if (keyboard_connected)
+        {
+            return STATUS_KEYBOARD_CONNECTED;
+        }
     }
 
     else
@@ -4,10 +4,19 @@
 
 #include "usb_hid.h"
 #include "defines.h"
+#include "hid_report_parser.h"
+#include "hid_mouse_decoder.h"
+#include "hid_keyboard.h"
+#include "hid_gamepad.h"
+#include "identity_cache.h"
+#include "spsc_queue.h"
+#include "mirror_pacing.h"
 #include "led_control.h"
 #include "lib/kmbox-commands/kmbox_commands.h"
 #include "pico/stdlib.h"
 #include "pico/unique_id.h"
+#include "pico/multicore.h"
+#include "device/usbd_pvt.h"
 #include "kmbox_serial_handler.h" // Include the header for serial handling
 #include "state_management.h"     // Include the header for state management
 #include "watchdog.h"             // Include the header for watchdog management
@@ -15,68 +24,108 @@
 
 uint16_t attached_vid = 0;
 uint16_t attached_pid = 0;
-bool attached_has_serial = false;
 
 
-static char attached_manufacturer[64] = "";
-static char attached_product[64] = "";
-static char attached_serial[32] = "";
-static bool string_descriptors_fetched = false;
+// What the PC is shown from the next enumeration on, and what it enumerated
+// with; a difference is what triggers a re-enumeration
+static device_identity_t identity;                      // Core 0
+static device_identity_t served_identity;               // Core 0
+static bool identity_complete = false;                  // Strings for this VID/PID have arrived
+static bool identity_dirty = false;                     // Not yet in the flash cache
 
-#define LANGUAGE_ID 0x0409 // English (US)
+static uint16_t fetched_strings[IDENTITY_STRING_COUNT][IDENTITY_STRING_UNITS];  // Core 1
 
+#define LANGUAGE_ID 0x0409 // English (US)
 
 
-static void utf16_to_utf8(uint16_t *utf16_buf, size_t utf16_buf_bytes, char *utf8_buf, size_t utf8_len)
+// The configuration descriptor and strings are read one control transfer at a
+// time from hid_host_task, so the mount callback returns at once and reports
+// flow while the identity catches up
+typedef enum
 {
-    if (!utf16_buf || !utf8_buf || utf8_len == 0)
-        return;
+    IDENTITY_FETCH_IDLE = 0,
+    IDENTITY_FETCH_CONFIG,
+    IDENTITY_FETCH_MANUFACTURER,
+    IDENTITY_FETCH_PRODUCT,
+    IDENTITY_FETCH_SERIAL,
+    IDENTITY_FETCH_DONE
+} identity_fetch_stage_t;
 
+typedef struct
+{
+    uint8_t stage;
+    bool in_flight;
+    uint8_t dev_addr;
+    uint32_t generation;            // Bumped on every reset; stale completions are ignored
+    uint32_t started_us;
+    union
+    {
+        uint16_t string[48];
+        uint8_t config[CFG_TUH_ENUMERATION_BUFSIZE];
+    } buf;
+    bool endpoints_ready;           // endpoints[] describes dev_addr
+    uint8_t endpoint_count;
+    struct
+    {
+        uint8_t itf_num;
+        uint8_t interval;
+        uint16_t size;
+    } endpoints[CFG_TUH_HID];       // First interrupt IN endpoint of each HID interface
+} identity_fetch_t;
 
+static identity_fetch_t identity_fetch = {0};                       // Core 1
+static hid_enumeration_stats_t enumeration_stats = {0};         // Core 1
 
-    const uint8_t *raw = (const uint8_t *)utf16_buf;
-    if (!raw)
-        return;
+static void post_strings_ready(uint8_t dev_addr);
+static void apply_fetched_endpoints(uint8_t dev_addr);
 
 
-    uint8_t bLength = raw[0];
-    if (bLength > utf16_buf_bytes)
-    {
-        bLength = (uint8_t)utf16_buf_bytes;
-    }
+// Re-enumeration runs as a state machine stepped from hid_device_task, so
+// neither core ever sleeps while the PC sees us detach and come back
+typedef enum
+{
+    REENUM_IDLE = 0,
+    REENUM_SETTLING,                // Waiting for the host side to go quiet
+    REENUM_DISCONNECTED,            // Off the bus for HID_REENUM_DISCONNECT_MS
+    REENUM_HOLDOFF                  // Back on the bus; the PC is enumerating us
+} reenum_state_t;
 
+static uint8_t reenum_state = REENUM_IDLE;
+static uint32_t reenum_state_ms = 0;
+static bool reenum_again = false;   // Requested during the hold-off
 
-    size_t code_units = 0;
-    if (bLength >= 2)
-    {
-        code_units = (size_t)(bLength - 2) / 2;
-    }
+static void build_device_interfaces(void);
+static void hid_request_task(void);
+static void drop_hid_request_for(uint8_t dev_addr, uint8_t instance);
+static void flush_mirror_reports(void);
+static void flush_gamepad_reports(void);
+static void mirror_out_task(void);
+static void reset_scroll_resolution(void);
 
-    size_t utf8_pos = 0;
-    for (size_t i = 0; i < code_units && utf8_pos < utf8_len - 1; i++)
-    {
 
-        uint16_t u = utf16_buf[1 + i];
 
+static void set_default_identity_strings(void)
+{
+    identity_encode_string(MANUFACTURER_STRING, identity.strings[IDENTITY_STRING_MANUFACTURER]);
+    identity_encode_string(PRODUCT_STRING, identity.strings[IDENTITY_STRING_PRODUCT]);
+    memset(identity.strings[IDENTITY_STRING_SERIAL], 0, sizeof(identity.strings[IDENTITY_STRING_SERIAL]));
+}
 
-        if (u == 0)
-            break;
+static inline bool identity_string_present(const uint16_t *desc)
+{
+    return (desc[0] & 0xFF) > STRING_DESC_HEADER_SIZE;
+}
 
-        if (u <= 0x7F)
-        {
-            utf8_buf[utf8_pos++] = (char)u;
-        }
-        else
-        {
+static void note_identity_change(void)
+{
+    identity_dirty = true;
 
-            utf8_buf[utf8_pos++] = '?';
-        }
+    if (memcmp(&identity, &served_identity, sizeof(identity)) != 0)
+    {
+        request_usb_reenumeration();
     }
-
-    utf8_buf[utf8_pos] = '\0';
 }
 
-
 void set_attached_device_vid_pid(uint16_t vid, uint16_t pid)
 {
 
@@ -84,94 +133,254 @@ void set_attached_device_vid_pid(uint16_t vid, uint16_t pid)
     {
         attached_vid = vid;
         attached_pid = pid;
-        attached_has_serial = false; // Default to no serial number unless device has one
+        identity.vid = vid;
+        identity.pid = pid;
+        identity_complete = false;
 
-
-        force_usb_reenumeration();
+        // Serve the strings last seen on this device until its own arrive
+        const device_identity_t *cached = identity_cache_find(vid, pid);
+        if (cached != NULL)
+        {
+            memcpy(identity.strings, cached->strings, sizeof(identity.strings));
+        }
+        else
+        {
+            set_default_identity_strings();
+        }
+        note_identity_change();
     }
-    else
+}
+
+static void set_reenum_state(uint8_t state)
+{
+    reenum_state = state;
+    reenum_state_ms = to_ms_since_boot(get_absolute_time());
+}
+
+// Deferred until the host side has been quiet for HID_REENUM_SETTLE_MS, so every
+// interface of a freshly attached device is in place before the PC enumerates us
+void request_usb_reenumeration(void)
+{
+    switch (reenum_state)
     {
+    case REENUM_IDLE:
+    case REENUM_SETTLING:
+        set_reenum_state(REENUM_SETTLING);
+        break;
+
+    case REENUM_HOLDOFF:
+        reenum_again = true;
+        break;
+
+    default:
+        break; // Interfaces are rebuilt on reconnect
     }
 }
 
+// Skips the settle time; the rest of the sequence still runs from hid_device_task
 void force_usb_reenumeration()
 {
-
+    if (reenum_state == REENUM_DISCONNECTED)
+    {
+        return;
+    }
 
     tud_disconnect();
+    set_reenum_state(REENUM_DISCONNECTED);
+}
 
+static void reenumeration_task(uint32_t current_ms)
+{
+    uint32_t const elapsed_ms = current_ms - reenum_state_ms;
 
-    sleep_ms(500);
-
-
-    tud_connect();
+    switch (reenum_state)
+    {
+    case REENUM_SETTLING:
+        if (elapsed_ms >= HID_REENUM_SETTLE_MS)
+        {
+            force_usb_reenumeration();
+        }
+        break;
 
+    case REENUM_DISCONNECTED:
+        if (elapsed_ms >= HID_REENUM_DISCONNECT_MS)
+        {
+            build_device_interfaces();
+            served_identity = identity;
+            reenum_again = false;
+            tud_connect();
+            set_reenum_state(REENUM_HOLDOFF);
+        }
+        break;
 
-    sleep_ms(250);
+    case REENUM_HOLDOFF:
+        if (elapsed_ms >= HID_REENUM_HOLDOFF_MS)
+        {
+            set_reenum_state(reenum_again ? REENUM_SETTLING : REENUM_IDLE);
+            reenum_again = false;
+        }
+        break;
 
+    default:
+        break;
+    }
 }
 
 
-static void fetch_device_string_descriptors(uint8_t dev_addr)
-{
-
-    memset(attached_manufacturer, 0, sizeof(attached_manufacturer));
-    memset(attached_product, 0, sizeof(attached_product));
-    memset(attached_serial, 0, sizeof(attached_serial));
-    string_descriptors_fetched = false;
+static void identity_fetch_complete_cb(tuh_xfer_t *xfer);
 
+static bool identity_fetch_submit(void)
+{
+    memset(&identity_fetch.buf, 0, sizeof(identity_fetch.buf));
+    uintptr_t const tag = identity_fetch.generation;
 
-    uint16_t temp_manufacturer[32];
-    uint16_t temp_product[48];
-    uint16_t temp_serial[16];
+    switch (identity_fetch.stage)
+    {
+    case IDENTITY_FETCH_CONFIG:
+        return tuh_descriptor_get_configuration(identity_fetch.dev_addr, 0, identity_fetch.buf.config,
+                                                sizeof(identity_fetch.buf.config), identity_fetch_complete_cb, tag);
+    case IDENTITY_FETCH_MANUFACTURER:
+        return tuh_descriptor_get_manufacturer_string(identity_fetch.dev_addr, LANGUAGE_ID, identity_fetch.buf.string,
+                                                      sizeof(identity_fetch.buf.string), identity_fetch_complete_cb, tag);
+    case IDENTITY_FETCH_PRODUCT:
+        return tuh_descriptor_get_product_string(identity_fetch.dev_addr, LANGUAGE_ID, identity_fetch.buf.string,
+                                                 sizeof(identity_fetch.buf.string), identity_fetch_complete_cb, tag);
+    case IDENTITY_FETCH_SERIAL:
+        return tuh_descriptor_get_serial_string(identity_fetch.dev_addr, LANGUAGE_ID, identity_fetch.buf.string,
+                                                sizeof(identity_fetch.buf.string), identity_fetch_complete_cb, tag);
+    default:
+        return false;
+    }
+}
 
+// Walks the configuration descriptor for the interrupt IN endpoint of every HID
+// interface; a truncated descriptor just yields fewer endpoints
+static void parse_config_endpoints(const uint8_t *desc, uint16_t len)
+{
+    identity_fetch.endpoint_count = 0;
 
-    memset(temp_manufacturer, 0, sizeof(temp_manufacturer));
-    memset(temp_product, 0, sizeof(temp_product));
-    memset(temp_serial, 0, sizeof(temp_serial));
+    uint8_t itf_num = 0;
+    bool want_endpoint = false;
+    for (uint16_t pos = 0; pos + 2 <= len; pos += desc[pos])
+    {
+        uint8_t const desc_len = desc[pos];
+        if (desc_len < 2 || pos + desc_len > len)
+        {
+            break;
+        }
 
+        if (desc[pos + 1] == TUSB_DESC_INTERFACE && desc_len >= 9)
+        {
+            itf_num = desc[pos + 2];
+            want_endpoint = desc[pos + 5] == TUSB_CLASS_HID;
+        }
+        else if (desc[pos + 1] == TUSB_DESC_ENDPOINT && desc_len >= 7 && want_endpoint &&
+                 (desc[pos + 2] & TUSB_DIR_IN_MASK) && (desc[pos + 3] & 0x03) == TUSB_XFER_INTERRUPT &&
+                 identity_fetch.endpoint_count < CFG_TUH_HID)
+        {
+            uint8_t const n = identity_fetch.endpoint_count++;
+            identity_fetch.endpoints[n].itf_num = itf_num;
+            identity_fetch.endpoints[n].size = (uint16_t)((desc[pos + 4] | (desc[pos + 5] << 8)) & 0x7FF);
+            identity_fetch.endpoints[n].interval = desc[pos + 6];
+            want_endpoint = false;
+        }
+    }
+}
 
-    if (tuh_descriptor_get_manufacturer_string_sync(dev_addr, LANGUAGE_ID, temp_manufacturer, sizeof(temp_manufacturer)) == XFER_RESULT_SUCCESS)
+static void identity_fetch_store(bool ok)
+{
+    if (identity_fetch.stage == IDENTITY_FETCH_CONFIG)
     {
-        utf16_to_utf8(temp_manufacturer, sizeof(temp_manufacturer), attached_manufacturer, sizeof(attached_manufacturer));
+        if (ok)
+        {
+            parse_config_endpoints(identity_fetch.buf.config, sizeof(identity_fetch.buf.config));
+            identity_fetch.endpoints_ready = true;
+            apply_fetched_endpoints(identity_fetch.dev_addr);
+        }
+        return; // Without it the default endpoint stays in place
     }
+
+    uint8_t const index = (uint8_t)(identity_fetch.stage - IDENTITY_FETCH_MANUFACTURER);
+    uint16_t *desc = fetched_strings[index];
+
+    if (ok)
+        identity_copy_string(identity_fetch.buf.string, sizeof(identity_fetch.buf.string), desc);
     else
+        memset(desc, 0, sizeof(fetched_strings[index]));
+
+    if (!identity_string_present(desc))
     {
-        strcpy(attached_manufacturer, MANUFACTURER_STRING); // Fallback
+        if (index == IDENTITY_STRING_MANUFACTURER)
+            identity_encode_string(MANUFACTURER_STRING, desc); // Fallback
+        else if (index == IDENTITY_STRING_PRODUCT)
+            identity_encode_string(PRODUCT_STRING, desc); // Fallback
     }
+}
 
-
-    if (tuh_descriptor_get_product_string_sync(dev_addr, LANGUAGE_ID, temp_product, sizeof(temp_product)) == XFER_RESULT_SUCCESS)
+static void identity_fetch_complete_cb(tuh_xfer_t *xfer)
+{
+    if (xfer->user_data != identity_fetch.generation || !identity_fetch.in_flight)
     {
-        utf16_to_utf8(temp_product, sizeof(temp_product), attached_product, sizeof(attached_product));
+        return; // Device went away or was replaced while this was in flight
     }
-    else
+
+    bool const ok = xfer->result == XFER_RESULT_SUCCESS;
+    if (!ok && identity_fetch.stage != IDENTITY_FETCH_CONFIG)
     {
-        strcpy(attached_product, PRODUCT_STRING); // Fallback
+        enumeration_stats.string_failures++;
     }
 
+    identity_fetch.in_flight = false;
+    identity_fetch_store(ok);
+    identity_fetch.stage++;
 
-    if (tuh_descriptor_get_serial_string_sync(dev_addr, LANGUAGE_ID, temp_serial, sizeof(temp_serial)) == XFER_RESULT_SUCCESS)
+    if (identity_fetch.stage == IDENTITY_FETCH_DONE)
     {
-        utf16_to_utf8(temp_serial, sizeof(temp_serial), attached_serial, sizeof(attached_serial));
-        attached_has_serial = (strlen(attached_serial) > 0);
+        enumeration_stats.strings_fetched++;
+        enumeration_stats.last_strings_us = time_us_32() - identity_fetch.started_us;
+        post_strings_ready(identity_fetch.dev_addr);
     }
-    else
+}
+
+// Issues the next request; the control pipe is shared by every device on the
+// hub, so a refused submit is simply retried on the next pass
+static void identity_fetch_task(void)
+{
+    if (identity_fetch.in_flight || identity_fetch.stage == IDENTITY_FETCH_IDLE || identity_fetch.stage == IDENTITY_FETCH_DONE)
+    {
+        return;
+    }
+
+    identity_fetch.in_flight = true;
+    if (!identity_fetch_submit())
     {
-        attached_has_serial = false;
+        identity_fetch.in_flight = false;
     }
+}
+
+static void fetch_device_identity(uint8_t dev_addr)
+{
 
-    string_descriptors_fetched = true;
+    memset(fetched_strings, 0, sizeof(fetched_strings));
+
+    identity_fetch.generation++;
+    identity_fetch.stage = IDENTITY_FETCH_CONFIG;
+    identity_fetch.in_flight = false;
+    identity_fetch.endpoints_ready = false;
+    identity_fetch.dev_addr = dev_addr;
+    identity_fetch.started_us = time_us_32();
+    identity_fetch_task();
 }
 
 
-static void reset_device_string_descriptors(void)
+static void reset_device_identity(void)
 {
-    memset(attached_manufacturer, 0, sizeof(attached_manufacturer));
-    memset(attached_product, 0, sizeof(attached_product));
-    memset(attached_serial, 0, sizeof(attached_serial));
-    string_descriptors_fetched = false;
-    attached_has_serial = false;
+    memset(fetched_strings, 0, sizeof(fetched_strings));
+
+    identity_fetch.generation++;
+    identity_fetch.stage = IDENTITY_FETCH_IDLE;
+    identity_fetch.in_flight = false;
+    identity_fetch.endpoints_ready = false;
 }
 
 
@@ -211,10 +420,17 @@ typedef struct
 } usb_error_tracker_t;
 
 
+// Primary mouse and keyboard; further ones on the hub only feed the merge stage
 typedef struct
 {
     bool mouse_connected;
     uint8_t mouse_dev_addr;
+    uint8_t mouse_instance;
+    uint8_t mouse_slot;
+    bool keyboard_connected;
+    uint8_t keyboard_dev_addr;
+    uint8_t keyboard_instance;
+    uint8_t keyboard_slot;
 } device_connection_state_t;
 
 
@@ -237,10 +453,32 @@ static bool generate_serial_string(void);
 
 
 static void handle_device_disconnection(uint8_t dev_addr);
-static void handle_hid_device_connection(uint8_t dev_addr, uint8_t itf_protocol);
+static void handle_hid_device_connection(uint8_t dev_addr, uint8_t instance, uint8_t slot, bool is_mouse, bool is_keyboard);
+
+
+static bool process_mouse_report_internal(const hid_mouse_sample_t *report);
 
 
-static bool process_mouse_report_internal(const hid_mouse_report_t *report);
+typedef struct
+{
+    bool in_flight;
+    uint8_t buttons;
+    int16_t x;
+    int16_t y;
+    int16_t wheel;
+    int16_t pan;
+} staged_mouse_report_t;
+
+
+static hid_frame_stats_t frame_stats = {0};
+static hid_backpressure_stats_t backpressure_stats = {0};
+static staged_mouse_report_t staged_report = {0};
+static uint8_t frame_last_buttons = 0;
+static uint32_t frame_last_report = 0;      // Frame of the last submitted report
+static uint16_t idle_interval_ms = 0;       // From SET_IDLE; 0 reports on change only
+static uint32_t report_rate_window_ms = 0;
+static uint32_t report_rate_base = 0;
+static hid_passthrough_stats_t passthrough_stats = {0};
 
 
 static void print_device_info(uint8_t dev_addr, const tusb_desc_device_t *desc);
@@ -248,606 +486,2656 @@ static void print_device_info(uint8_t dev_addr, const tusb_desc_device_t *desc);
 
 #define HID_DESC_BUF_SIZE 256
 
-static const uint8_t desc_hid_mouse_default[] = {
-    TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(REPORT_ID_MOUSE))};
+typedef enum
+{
+    DEVICE_ITF_MOUSE = 0,
+    DEVICE_ITF_KEYBOARD,
+    DEVICE_ITF_MIRROR               // Another interface of the attached device, forwarded as is
+} device_itf_role_t;
 
-static const uint8_t desc_hid_consumer[] = {
-    TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL))};
+typedef struct
+{
+    uint8_t role;
+    uint8_t host_slot;              // Mirrored host interface (DEVICE_ITF_MIRROR only)
+    uint8_t ep_size;
+    uint8_t ep_interval;
+    bool has_out;                   // Interrupt OUT endpoint, mirrored from the host interface
+} device_hid_itf_t;
 
+#define DEVICE_ITF_NONE 0xFF
 
-const uint8_t desc_hid_report[] = {
-    TUD_HID_REPORT_DESC_MOUSE(HID_REPORT_ID(REPORT_ID_MOUSE)),
-    TUD_HID_REPORT_DESC_CONSUMER(HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL))};
+// Interface N of the device configuration is HID instance N and uses EPNUM_HID + N
+static device_hid_itf_t device_itfs[HID_DEVICE_MAX_INTERFACES];
+static uint8_t device_itf_count = 0;
+static uint8_t device_mouse_itf = 0;
+static uint8_t device_keyboard_itf = 1;
 
-static uint8_t desc_hid_report_runtime[HID_DESC_BUF_SIZE];
-static size_t desc_hid_runtime_len = 0;
-static bool desc_hid_runtime_valid = false;
 
-static uint8_t host_mouse_desc[HID_DESC_BUF_SIZE];
-static size_t host_mouse_desc_len = 0;
-static bool host_mouse_has_report_id = false;
-static uint8_t host_mouse_report_id = 0;
+// One slot per host HID interface across every device on the hub, found from
+// (dev_addr, instance) through host_slot_lookup. Core 1 owns the slots and fills
+// one before announcing it; core 0 keeps its own copy of what it exposes.
+#define HOST_DEV_ADDR_MAX (CFG_TUH_DEVICE_MAX + CFG_TUH_HUB)
 
-static void build_runtime_hid_report_with_mouse(const uint8_t *mouse_desc, size_t mouse_len)
+typedef struct
 {
+    bool used;
+    bool is_mouse;
+    bool is_keyboard;
+    bool is_gamepad;                // Mirrored, but on the pointer-class fast path
+    bool mirrors_extra;             // Keyboard whose other reports (consumer, system) are mirrored
+    bool uses_report_ids;
+    bool raw_ok;                    // Pointer reports match desc (not the boot fallback)
+    uint8_t index;
+    uint8_t dev_addr;
+    uint8_t instance;
+    uint16_t desc_len;
+    uint8_t desc[HID_DESC_BUF_SIZE];
+    uint8_t itf_num;                // bInterfaceNumber on the attached device
+    bool has_out;                   // Interrupt OUT endpoint besides the IN one
+    uint32_t mount_us;              // For mount-to-first-report latency
+    bool reported;                  // First report seen
+    hid_mouse_decoder_t mouse;
+    hid_report_plan_t keyboard;
+    hid_gamepad_layout_t gamepad;
+} host_itf_slot_t;
+
+static uint8_t primary_dev_addr(void);
+static void release_host_itf_slot(host_itf_slot_t *slot);
+static void promote_primary_interfaces(void);
+static void announce_primary_device(uint8_t previous_primary);
+static void apply_host_multiplier(const host_itf_slot_t *slot);
 
-    size_t pos = 0;
-
+typedef struct
+{
+    bool active;
+    uint8_t dev_addr;
+    uint8_t instance;
+    bool uses_report_ids;
+    bool has_out;
+    uint8_t device_itf;             // DEVICE_ITF_NONE while not exposed
+    uint16_t desc_len;
+    uint8_t desc[HID_DESC_BUF_SIZE];
+    bool is_gamepad;
+    hid_gamepad_layout_t gamepad;
+} mirror_itf_t;
 
-    if (mouse_desc != NULL && mouse_len > 0)
-    {
-        if (pos + mouse_len >= HID_DESC_BUF_SIZE)
-            return;
-        memcpy(&desc_hid_report_runtime[pos], mouse_desc, mouse_len);
-        pos += mouse_len;
-    }
-    else
-    {
-        size_t dlen = sizeof(desc_hid_mouse_default);
-        if (pos + dlen >= HID_DESC_BUF_SIZE)
-            return;
-        memcpy(&desc_hid_report_runtime[pos], desc_hid_mouse_default, dlen);
-        pos += dlen;
-    }
+typedef struct
+{
+    bool valid;
+    uint8_t dev_addr;
+    uint8_t instance;
+    uint8_t slot;
+} host_itf_ref_t;
+
+static host_itf_slot_t host_itf_slots[CFG_TUH_HID];                         // Core 1
+static uint8_t host_slot_lookup[HOST_DEV_ADDR_MAX + 1][CFG_TUH_HID];        // Core 1; slot + 1, 0 when free
+static volatile uint8_t host_itfs_used = 0;                                   // Core 1 writes, core 0 reads; slots in use
+static mirror_itf_t mirror_itfs[CFG_TUH_HID];           // Core 0
+static host_itf_ref_t mirror_mouse_ref = {0};           // Core 0
+static host_itf_ref_t mirror_keyboard_ref = {0};        // Core 0
+static uint8_t slot_buttons[CFG_TUH_HID];               // Core 0; per-mouse buttons for the merge
+static hid_key_bitmap_t slot_keys[CFG_TUH_HID];         // Core 0; per-keyboard keys for the merge
 
+typedef struct
+{
+    uint16_t size;
+    uint8_t interval;               // 0 until the configuration descriptor has been read
+} host_ep_t;
 
-    size_t clen = sizeof(desc_hid_consumer);
-    if (pos + clen >= HID_DESC_BUF_SIZE)
-        return;
-    memcpy(&desc_hid_report_runtime[pos], desc_hid_consumer, clen);
-    pos += clen;
+static host_ep_t host_eps[CFG_TUH_HID];                 // Core 0; interrupt IN endpoint per host slot
 
+typedef struct
+{
+    uint8_t wheel;                  // Counts per detent; 0 reads as 1
+    uint8_t pan;
+} scroll_resolution_t;
 
-    for (; pos < HID_DESC_BUF_SIZE; ++pos)
-    {
-        desc_hid_report_runtime[pos] = 0xC0;
-    }
+static scroll_resolution_t slot_scroll[CFG_TUH_HID];            // Core 0; what each host mouse reports in
+static scroll_resolution_t slot_scroll_pending[CFG_TUH_HID];    // Core 0; applies once the mouse accepts it
+static scroll_resolution_t output_scroll = {1, 1};              // Core 0; what the PC expects
+static uint8_t multiplier_report[HID_PLAN_MAX_REPORT_BYTES];    // Core 0; the PC's last multiplier setting
+static uint16_t multiplier_report_len = 0;
 
-    desc_hid_runtime_len = HID_DESC_BUF_SIZE;
-    desc_hid_runtime_valid = true;
-}
 
-bool usb_hid_init(void)
+// Reports on the mirrored interfaces (vendor configuration channels and the like)
+// queue per interface in both directions, so one chatty interface cannot hold up
+// another. To the PC they go out after the mouse, a few per frame; to the attached
+// device they are spaced out so pointer polling on the host bus keeps its slots.
+typedef struct
 {
+    uint8_t dev_addr;                       // OUT: host interface the report is for
+    uint8_t instance;
+    uint8_t len;
+    uint32_t received_us;                   // IN: when core 1 took it off the host bus
+    uint8_t data[HID_PLAN_MAX_REPORT_BYTES]; // Report ID first when the interface uses them
+} mirror_report_t;
+
+static spsc_queue<mirror_report_t, HID_MIRROR_QUEUE_DEPTH> mirror_in_queues[CFG_TUH_HID];   // Core 0
+static spsc_queue<mirror_report_t, HID_MIRROR_QUEUE_DEPTH> mirror_out_queues[CFG_TUH_HID];  // Core 0 -> core 1
+static mirror_in_pacer<CFG_TUH_HID> mirror_in;             // Core 0
+static mirror_out_pacer<CFG_TUH_HID> mirror_out;           // Core 1
+static hid_mirror_stats_t mirror_stats = {0};               // in_throttled, in_unrouted and the out_ transfer counts from core 1
+
+
+// Gamepads are mirrored interfaces too, but their reports skip the per-frame budget
+// and go out as soon as they arrive, like the mouse's. A busy endpoint keeps only the
+// newest report, since each one carries the whole controller state.
+typedef struct
+{
+    mirror_report_t last;           // Newest report from the gamepad, as received
+    bool pending;                   // last has not reached the endpoint yet
+    uint32_t sequence;              // kmbox gamepad sequence in the last report sent
+} gamepad_path_t;
 
-    if (!generate_serial_string())
-    {
-        return false;
-    }
-
-    gpio_init(PIN_BUTTON);
-
-    gpio_set_dir(PIN_BUTTON, GPIO_IN);
-    gpio_pull_up(PIN_BUTTON);
+static gamepad_path_t gamepad_paths[CFG_TUH_HID];       // Core 0
 
 
-    memset(&connection_state, 0, sizeof(connection_state));
+// Host receive to device endpoint, per device class. Mouse and keyboard input is
+// merged, so their reports count from the oldest input they carry.
+typedef struct
+{
+    bool pending;
+    uint32_t received_us;
+} pending_input_t;
 
+static hid_latency_stats_t latency_stats = {0};         // Core 0
+static pending_input_t mouse_input = {0};               // Core 0
+static pending_input_t keyboard_input = {0};            // Core 0
 
-    build_runtime_hid_report_with_mouse(NULL, 0);
 
-    (void)0; // suppressed init log
-    return true;
-}
+static const uint8_t desc_hid_mouse_default[] = {
+    TUD_HID_REPORT_DESC_MOUSE16(HID_REPORT_ID(REPORT_ID_MOUSE))};
 
-static bool generate_serial_string(void)
-{
-    pico_unique_board_id_t board_id;
-    pico_get_unique_board_id(&board_id);
+const uint8_t desc_hid_report[] = {
+    TUD_HID_REPORT_DESC_MOUSE16(HID_REPORT_ID(REPORT_ID_MOUSE))};
 
+static const uint8_t desc_hid_keyboard_report[] = {
+    TUD_HID_REPORT_DESC_KEYBOARD_NKRO()};
 
+static uint8_t desc_hid_report_runtime[HID_DESC_BUF_SIZE];
+static size_t desc_hid_runtime_len = 0;
+static bool desc_hid_runtime_valid = false;
 
 
+static hid_report_plan_t device_mouse_plan;
+static const hid_report_layout_t *device_mouse_layout = NULL;
+static bool device_mirrors_host = false;    // Exposed descriptor is the host mouse's own
 
-    for (int i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++)
-    {
-        int result = snprintf(&serial_string[i * SERIAL_HEX_CHARS_PER_BYTE],
-                              SERIAL_SNPRINTF_BUFFER_SIZE,
-                              "%02X",
-                              board_id.id[i]);
-        if (result < 0 || result >= SERIAL_SNPRINTF_BUFFER_SIZE)
-        {
-            return false;
-        }
-    }
+static uint32_t host_mouse_report_count = 0;
+static uint32_t host_input_report_count = 0;            // Core 1; every interface
+static hid_poll_stats_t poll_stats = {0};               // Core 1
+static uint32_t input_rate_window_ms = 0;               // Core 1
+static uint32_t input_rate_mouse_base = 0;
+static uint32_t input_rate_base = 0;
 
-    serial_string[SERIAL_STRING_LENGTH] = '\0'; // Ensure null termination
-    return true;
-}
+static hid_key_bitmap_t keyboard_physical;  // Keys held on all attached keyboards
+static hid_key_bitmap_t keyboard_injected;  // Keys held by usb_hid_set_injected_key
+static hid_key_bitmap_t keyboard_sent;      // Last state the PC accepted
 
-bool usb_host_enable_power(void)
-{
-#ifdef PIN_USB_5V
-    gpio_put(PIN_USB_5V, 1); // Enable USB power
-#endif
-    sleep_ms(100); // Allow power to stabilize
-    return true;
-}
 
-void usb_device_mark_initialized(void)
+typedef enum
 {
-    usb_device_initialized = true;
-}
+    HID_EVENT_MOUSE = 0,
+    HID_EVENT_MOUSE_MOUNTED,
+    HID_EVENT_DEVICE_MOUNTED,
+    HID_EVENT_UNMOUNTED,
+    HID_EVENT_KEYBOARD,
+    HID_EVENT_KEYBOARD_MOUNTED,
+    HID_EVENT_KEYBOARD_UNMOUNTED,
+    HID_EVENT_ITF_MOUNTED,
+    HID_EVENT_ITF_UNMOUNTED,
+    HID_EVENT_ITF_REPORT,
+    HID_EVENT_STRINGS_READY,
+    HID_EVENT_ENDPOINT,
+    HID_EVENT_REPORT_FETCHED,               // GET_REPORT answer from the attached device; raw_len 0 when it failed
+    HID_EVENT_SCROLL_RESOLUTION,            // The mouse accepted its Resolution Multiplier setting
+    HID_EVENT_GAMEPAD
+} hid_event_type_t;
 
-void usb_host_mark_initialized(void)
+typedef struct
 {
-    usb_host_initialized = true;
-}
+    uint8_t type;
+    uint8_t dev_addr;
+    uint8_t instance;
+    uint8_t slot;                           // host_itf_slots index
+    bool has_sample;                        // mouse holds a decoded pointer report
+    uint8_t raw_len;
+    uint32_t received_us;                   // Input events: when core 1 took the report off the host bus
+    union
+    {
+        hid_mouse_sample_t mouse;
+        hid_key_bitmap_t keys;
+        struct
+        {
+            uint16_t vid;
+            uint16_t pid;
+        } identity;
+        struct
+        {
+            uint16_t desc_len;
+            bool raw_ok;                    // Reports match desc; false when the boot plan was used
+        } mounted;
+        host_ep_t endpoint;
+        struct
+        {
+            uint8_t seq;                    // Of the PC's GET_REPORT it answers
+        } fetched;
+    };
+    uint8_t raw[HID_PLAN_MAX_REPORT_BYTES]; // Host report as received, for passthrough
+} hid_input_event_t;
 
 
+static spsc_queue<hid_input_event_t, HID_EVENT_QUEUE_DEPTH> hid_event_queue;
+static uint32_t hid_events_popped = 0;
+static uint32_t hid_doorbells = 0;
 
+static void answer_forwarded_get(const hid_input_event_t *event);
+static void expire_forwarded_get(void);
 
 
-bool get_caps_lock_state(void)
+// SET_REPORT/GET_REPORT from the PC on their way to the attached device. Core 0
+// queues them from the control callbacks; core 1 issues them one at a time
+// between interrupt transfers, so neither side ever waits on the other.
+typedef enum
 {
-    return caps_lock_state;
-}
+    HID_REQUEST_SET = 0,
+    HID_REQUEST_GET,
+    HID_REQUEST_SET_LEDS,                   // Keyboard LEDs, fanned out to every host keyboard
+    HID_REQUEST_SET_MULTIPLIER              // Resolution Multiplier; its completion rescales the wheel
+} hid_request_kind_t;
 
-bool is_mouse_connected(void)
+typedef struct
 {
-    return connection_state.mouse_connected;
+    uint8_t kind;
+    uint8_t dev_addr;
+    uint8_t instance;
+    uint8_t seq;                            // GET: matches the answer to the PC's pending request
+    uint8_t report_id;
+    uint8_t report_type;
+    uint16_t len;
+    uint8_t data[HID_PLAN_MAX_REPORT_BYTES]; // Report ID first when report_id is not 0
+} hid_request_t;
+
+
+static spsc_queue<hid_request_t, HID_REQUEST_QUEUE_DEPTH> hid_request_queue;  // Core 0 -> core 1
+static hid_forward_stats_t forward_stats = {0};
+
+// A wake hint only: it is skipped when the FIFO is full and the flash lockout
+// handshake can swallow it, so hid_event_task never waits for one
+static void ring_hid_doorbell(void)
+{
+    if (multicore_fifo_wready())
+    {
+        multicore_fifo_push_blocking(HID_EVENT_DOORBELL);
+    }
 }
 
-static void handle_device_disconnection(uint8_t dev_addr)
+static void post_hid_event(const hid_input_event_t *event)
 {
 
-    if (dev_addr == connection_state.mouse_dev_addr)
+    if (hid_event_queue.push(*event))
     {
-        connection_state.mouse_connected = false;
-        connection_state.mouse_dev_addr = 0;
+        ring_hid_doorbell();
     }
 }
 
-static void handle_hid_device_connection(uint8_t dev_addr, uint8_t itf_protocol)
+static bool build_device_mouse_layout(void)
 {
-
-    if (dev_addr == 0)
+    device_mouse_layout = NULL;
+    if (!hid_parse_report_descriptor(desc_hid_report_runtime, (uint16_t)desc_hid_runtime_len, &device_mouse_plan))
     {
-
-        return;
+        return false;
     }
 
-
-
-    switch (itf_protocol)
+    for (uint8_t i = 0; i < device_mouse_plan.report_count; i++)
     {
-    case HID_ITF_PROTOCOL_MOUSE:
-        connection_state.mouse_connected = true;
-        connection_state.mouse_dev_addr = dev_addr;
-        neopixel_trigger_mouse_activity(); // Flash magenta for mouse connection
-        break;
-
-    default:
-
-        break;
+        if (device_mouse_plan.reports[i].fields[HID_FIELD_X].bit_size != 0)
+        {
+            device_mouse_layout = &device_mouse_plan.reports[i];
+            break;
+        }
+    }
+    if (device_mouse_layout == NULL)
+    {
+        return false;
     }
 
 
-    neopixel_update_status();
+    int32_t x_min, x_max, y_min, y_max, wheel_min, wheel_max, pan_min, pan_max;
+    hid_field_get_range(&device_mouse_layout->fields[HID_FIELD_X], &x_min, &x_max);
+    hid_field_get_range(&device_mouse_layout->fields[HID_FIELD_Y], &y_min, &y_max);
+    hid_field_get_range(&device_mouse_layout->fields[HID_FIELD_WHEEL], &wheel_min, &wheel_max);
+    hid_field_get_range(&device_mouse_layout->fields[HID_FIELD_PAN], &pan_min, &pan_max);
+
+    int32_t const move_min = TU_MAX(TU_MAX(x_min, y_min), (int32_t)INT16_MIN);
+    int32_t const move_max = TU_MIN(TU_MIN(x_max, y_max), (int32_t)INT16_MAX);
+    kmbox_set_report_limits((int16_t)TU_MIN(move_min, 0), (int16_t)TU_MAX(move_max, 0),
+                            (int16_t)TU_MIN(TU_MAX(wheel_min, (int32_t)INT16_MIN), 0),
+                            (int16_t)TU_MAX(TU_MIN(wheel_max, (int32_t)INT16_MAX), 0),
+                            (int16_t)TU_MIN(TU_MAX(pan_min, (int32_t)INT16_MIN), 0),
+                            (int16_t)TU_MAX(TU_MIN(pan_max, (int32_t)INT16_MAX), 0));
+    return true;
 }
 
-static bool process_mouse_report_internal(const hid_mouse_report_t *report)
+static bool build_runtime_hid_report_with_mouse(const uint8_t *mouse_desc, size_t mouse_len)
 {
-    if (!report || !tud_mounted() || !tud_ready() || !tud_hid_ready())
-        return false;
 
+    size_t pos = 0;
+    device_mirrors_host = false;
 
-    uint8_t valid_buttons = report->buttons & 0x1F; 
-
-    kmbox_update_physical_buttons(valid_buttons);
 
-    if (report->x != 0 || report->y != 0)
-        kmbox_add_mouse_movement(report->x, report->y);
+    if (mouse_desc != NULL && mouse_len > 0)
+    {
+        if (pos + mouse_len >= HID_DESC_BUF_SIZE)
+            return false;
+        memcpy(&desc_hid_report_runtime[pos], mouse_desc, mouse_len);
+        pos += mouse_len;
+    }
+    else
+    {
+        size_t dlen = sizeof(desc_hid_mouse_default);
+        if (pos + dlen >= HID_DESC_BUF_SIZE)
+            return false;
+        memcpy(&desc_hid_report_runtime[pos], desc_hid_mouse_default, dlen);
+        pos += dlen;
+    }
+
+
+    desc_hid_runtime_len = pos;
+    desc_hid_runtime_valid = true;
+
+
+    if (!build_device_mouse_layout())
+    {
+        if (mouse_desc != NULL)
+        {
+            build_runtime_hid_report_with_mouse(NULL, 0);
+        }
+        return false;
+    }
+    return mouse_desc != NULL;
+}
+
+// Mirrored interfaces take the attached device's packet size; reports never
+// outgrow it since their descriptor is the device's own
+static uint8_t clamp_device_ep_size(uint16_t size)
+{
+    return (uint8_t)TU_MIN(TU_MAX(size, (uint16_t)8), (uint16_t)CFG_TUD_HID_EP_BUFSIZE);
+}
+
+static void update_identity_endpoints(void)
+{
+    if (mirror_mouse_ref.valid && host_eps[mirror_mouse_ref.slot].interval != 0)
+    {
+        host_ep_t const *ep = &host_eps[mirror_mouse_ref.slot];
+        identity.mouse_ep_size = identity.report_desc_len ? clamp_device_ep_size(ep->size) : 0;
+        identity.mouse_ep_interval = ep->interval;
+    }
+    if (mirror_keyboard_ref.valid && host_eps[mirror_keyboard_ref.slot].interval != 0)
+    {
+        identity.keyboard_ep_interval = host_eps[mirror_keyboard_ref.slot].interval;
+    }
+}
+
+// Mouse and keyboard are always exposed; the attached device's other interfaces
+// follow, all in that device's own interface order
+static uint8_t plan_device_interfaces(device_hid_itf_t *itfs)
+{
+    uint16_t keys[HID_DEVICE_MAX_INTERFACES];
+    uint8_t count = 0;
+
+    uint8_t dev_addr = 0;
+    if (mirror_mouse_ref.valid)
+        dev_addr = mirror_mouse_ref.dev_addr;
+    else if (mirror_keyboard_ref.valid)
+        dev_addr = mirror_keyboard_ref.dev_addr;
+
+    bool const mouse_here = mirror_mouse_ref.valid && mirror_mouse_ref.dev_addr == dev_addr;
+    bool const keyboard_here = mirror_keyboard_ref.valid && mirror_keyboard_ref.dev_addr == dev_addr;
+
+    itfs[count] = (device_hid_itf_t){DEVICE_ITF_MOUSE, 0,
+                                     identity.mouse_ep_size ? identity.mouse_ep_size : (uint8_t)CFG_TUD_HID_EP_BUFSIZE,
+                                     identity.mouse_ep_interval ? identity.mouse_ep_interval : (uint8_t)HID_POLLING_INTERVAL_MS, false};
+    keys[count++] = mouse_here ? mirror_mouse_ref.instance : 0;
+    itfs[count] = (device_hid_itf_t){DEVICE_ITF_KEYBOARD, 0, HID_KEYBOARD_EP_SIZE,
+                                     identity.keyboard_ep_interval ? identity.keyboard_ep_interval : (uint8_t)HID_POLLING_INTERVAL_MS, false};
+    keys[count++] = keyboard_here ? mirror_keyboard_ref.instance : 0x100;
+
+    for (uint8_t slot = 0; slot < CFG_TUH_HID && count < HID_DEVICE_MAX_INTERFACES; slot++)
+    {
+        if (mirror_itfs[slot].active && dev_addr != 0 && mirror_itfs[slot].dev_addr == dev_addr)
+        {
+            bool const known = host_eps[slot].interval != 0;
+            itfs[count] = (device_hid_itf_t){DEVICE_ITF_MIRROR, slot,
+                                             known ? clamp_device_ep_size(host_eps[slot].size) : (uint8_t)CFG_TUD_HID_EP_BUFSIZE,
+                                             known ? host_eps[slot].interval : (uint8_t)HID_POLLING_INTERVAL_MS,
+                                             mirror_itfs[slot].has_out};
+            keys[count++] = mirror_itfs[slot].instance;
+        }
+    }
+
+
+    for (uint8_t i = 1; i < count; i++)
+    {
+        device_hid_itf_t const itf = itfs[i];
+        uint16_t const key = keys[i];
+        uint8_t j = i;
+        for (; j > 0 && keys[j - 1] > key; j--)
+        {
+            itfs[j] = itfs[j - 1];
+            keys[j] = keys[j - 1];
+        }
+        itfs[j] = itf;
+        keys[j] = key;
+    }
+    return count;
+}
+
+static void build_device_interfaces(void)
+{
+    device_itf_count = plan_device_interfaces(device_itfs);
+    reset_scroll_resolution();
+
+    for (uint8_t slot = 0; slot < CFG_TUH_HID; slot++)
+    {
+        mirror_itfs[slot].device_itf = DEVICE_ITF_NONE;
+    }
+    for (uint8_t itf = 0; itf < device_itf_count; itf++)
+    {
+        switch (device_itfs[itf].role)
+        {
+        case DEVICE_ITF_MOUSE:
+            device_mouse_itf = itf;
+            break;
+        case DEVICE_ITF_KEYBOARD:
+            device_keyboard_itf = itf;
+            break;
+        default:
+            mirror_itfs[device_itfs[itf].host_slot].device_itf = itf;
+            break;
+        }
+    }
+}
+
+static bool device_interfaces_changed(void)
+{
+    device_hid_itf_t planned[HID_DEVICE_MAX_INTERFACES];
+    uint8_t const count = plan_device_interfaces(planned);
+    if (count != device_itf_count)
+    {
+        return true;
+    }
+
+    for (uint8_t itf = 0; itf < count; itf++)
+    {
+        if (planned[itf].role != device_itfs[itf].role || planned[itf].host_slot != device_itfs[itf].host_slot ||
+            planned[itf].ep_size != device_itfs[itf].ep_size || planned[itf].ep_interval != device_itfs[itf].ep_interval ||
+            planned[itf].has_out != device_itfs[itf].has_out)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void check_device_interfaces(void)
+{
+    // Any mount while a re-enumeration is settling pushes it back
+    if (reenum_state == REENUM_SETTLING || device_interfaces_changed())
+    {
+        request_usb_reenumeration();
+    }
+}
+
+bool usb_hid_init(void)
+{
+
+    if (!generate_serial_string())
+    {
+        return false;
+    }
+
+    gpio_init(PIN_BUTTON);
+
+    gpio_set_dir(PIN_BUTTON, GPIO_IN);
+    gpio_pull_up(PIN_BUTTON);
+
+
+    memset(&connection_state, 0, sizeof(connection_state));
+
+
+    // Enumerate as the last attached device; when it is plugged back in and
+    // nothing differs, no disconnect/reconnect cycle is needed
+    identity_cache_init();
+    memset(&identity, 0, sizeof(identity));
+    set_default_identity_strings();
+
+    const device_identity_t *cached = identity_cache_last();
+    if (cached != NULL)
+    {
+        identity = *cached;
+        attached_vid = identity.vid;
+        attached_pid = identity.pid;
+        identity_complete = true;
+    }
+    build_runtime_hid_report_with_mouse(identity.report_desc_len ? identity.report_desc : NULL, identity.report_desc_len);
+    build_device_interfaces();
+    served_identity = identity;
+
+    (void)0; // suppressed init log
+    return true;
+}
+
+static bool generate_serial_string(void)
+{
+    pico_unique_board_id_t board_id;
+    pico_get_unique_board_id(&board_id);
+
+
+
+
+
+    for (int i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++)
+    {
+        int result = snprintf(&serial_string[i * SERIAL_HEX_CHARS_PER_BYTE],
+                              SERIAL_SNPRINTF_BUFFER_SIZE,
+                              "%02X",
+                              board_id.id[i]);
+        if (result < 0 || result >= SERIAL_SNPRINTF_BUFFER_SIZE)
+        {
+            return false;
+        }
+    }
+
+    serial_string[SERIAL_STRING_LENGTH] = '\0'; // Ensure null termination
+    return true;
+}
+
+bool usb_host_enable_power(void)
+{
+#ifdef PIN_USB_5V
+    gpio_put(PIN_USB_5V, 1); // Enable USB power
+#endif
+    sleep_ms(100); // Allow power to stabilize
+    return true;
+}
+
+void usb_device_mark_initialized(void)
+{
+    usb_device_initialized = true;
+}
+
+void usb_host_mark_initialized(void)
+{
+    usb_host_initialized = true;
+}
+
+
+
+
+
+bool get_caps_lock_state(void)
+{
+    return caps_lock_state;
+}
+
+bool is_mouse_connected(void)
+{
+    return connection_state.mouse_connected;
+}
+
+bool is_keyboard_connected(void)
+{
+    return connection_state.keyboard_connected;
+}
+
+// Normally every interface is already gone through tuh_hid_umount_cb by now
+static void handle_device_disconnection(uint8_t dev_addr)
+{
+    uint8_t const previous_primary = primary_dev_addr();
+
+    for (uint8_t index = 0; index < CFG_TUH_HID; index++)
+    {
+        if (host_itf_slots[index].used && host_itf_slots[index].dev_addr == dev_addr)
+        {
+            release_host_itf_slot(&host_itf_slots[index]);
+        }
+    }
+    promote_primary_interfaces();
+    announce_primary_device(previous_primary);
+}
+
+
+static void handle_hid_device_connection(uint8_t dev_addr, uint8_t instance, uint8_t slot, bool is_mouse, bool is_keyboard)
+{
+
+    if (dev_addr == 0)
+    {
+
+        return;
+    }
+
+
+    if (is_mouse)
+    {
+        connection_state.mouse_connected = true;
+        connection_state.mouse_dev_addr = dev_addr;
+        connection_state.mouse_instance = instance;
+        connection_state.mouse_slot = slot;
+    }
+
+    if (is_keyboard)
+    {
+        connection_state.keyboard_connected = true;
+        connection_state.keyboard_dev_addr = dev_addr;
+        connection_state.keyboard_instance = instance;
+        connection_state.keyboard_slot = slot;
+    }
+
+
+    neopixel_update_status();
+}
+
+static int32_t scroll_units(int16_t counts, uint8_t resolution)
+{
+    return (int32_t)counts * KMBOX_SCROLL_UNITS_PER_DETENT / (resolution ? resolution : 1);
+}
+
+// Wheel and pan arrive in the mouse's own counts per detent and are merged in
+// fractions of a detent, so hi-res input reaches the PC at its resolution
+static bool process_mouse_report_internal(const hid_mouse_sample_t *report, const scroll_resolution_t *resolution)
+{
+    if (!report || !tud_mounted())
+        return false;
+
+
+    uint8_t valid_buttons = report->buttons & 0x1F; 
+
+    kmbox_update_physical_buttons(valid_buttons);
+
+    if (report->x != 0 || report->y != 0)
+        kmbox_add_mouse_movement(report->x, report->y);
+
+    if (report->wheel != 0 || report->pan != 0)
+        kmbox_add_scroll_units(scroll_units(report->wheel, resolution->wheel), scroll_units(report->pan, resolution->pan));
+
+    frame_stats.merged_inputs++;
+    return true;
+}
+
+
+static void record_latency(uint8_t device_class, uint32_t received_us)
+{
+    hid_latency_class_stats_t *stats = &latency_stats.classes[device_class];
+    uint32_t const latency_us = time_us_32() - received_us;
+    stats->reports++;
+    stats->last_us = latency_us;
+    stats->total_us += latency_us;
+    if (latency_us > stats->max_us)
+    {
+        stats->max_us = latency_us;
+    }
+}
+
+static inline void note_input(pending_input_t *input, uint32_t received_us)
+{
+    if (!input->pending)
+    {
+        input->pending = true;
+        input->received_us = received_us;
+    }
+}
+
+// sent: the input reached the endpoint; otherwise it changed nothing and is dropped
+static inline void settle_input(pending_input_t *input, uint8_t device_class, bool sent)
+{
+    if (input->pending && sent)
+    {
+        record_latency(device_class, input->received_us);
+    }
+    input->pending = false;
+}
+
+// Whether the accumulators hold input beyond the report in flight, or beyond the
+// last acknowledged one when none is. X/Y come from the raw accumulators, since
+// the peeked values are clamped to what one report carries.
+static bool mouse_input_waiting(uint8_t buttons, int16_t wheel, int16_t pan)
+{
+    int64_t fed_x, fed_y;
+    int32_t pending_x, pending_y;
+    kmbox_get_motion_totals(&fed_x, &fed_y, &pending_x, &pending_y);
+
+    if (!staged_report.in_flight)
+    {
+        return buttons != frame_last_buttons || pending_x != 0 || pending_y != 0 || wheel != 0 || pan != 0;
+    }
+    return buttons != staged_report.buttons || pending_x != staged_report.x || pending_y != staged_report.y ||
+           wheel != staged_report.wheel || pan != staged_report.pan;
+}
+
+bool usb_hid_flush_mouse_report(void)
+{
+    uint8_t buttons;
+    int16_t x, y, wheel, pan;
+    kmbox_peek_mouse_report(&buttons, &x, &y, &wheel, &pan);
+
+    if (staged_report.in_flight || !tud_hid_n_ready(device_mouse_itf))
+    {
+        if (mouse_input_waiting(buttons, wheel, pan))
+        {
+            backpressure_stats.endpoint_busy++;
+        }
+        return false;
+    }
+
+    bool const idle_due = idle_interval_ms != 0 && (frame_stats.frames - frame_last_report) >= idle_interval_ms;
+    if (buttons == frame_last_buttons && x == 0 && y == 0 && wheel == 0 && pan == 0 && !idle_due)
+    {
+        settle_input(&mouse_input, HID_LATENCY_MOUSE, false);
+        return false;
+    }
+
+    if (!usb_hid_send_mouse_report(buttons, x, y, wheel, pan))
+    {
+        backpressure_stats.send_failures++;
+        return false;
+    }
+    frame_last_report = frame_stats.frames;
+    settle_input(&mouse_input, HID_LATENCY_MOUSE, true);
+
+
+    staged_report.buttons = buttons;
+    staged_report.x = x;
+    staged_report.y = y;
+    staged_report.wheel = wheel;
+    staged_report.pan = pan;
+    staged_report.in_flight = true;
+    return true;
+}
+
+
+// One report per frame: everything merged since the last SOF is queued here so it
+// is on the endpoint before this frame's IN token
+void tud_sof_cb(uint32_t frame_count)
+{
+    (void)frame_count;
+    frame_stats.frames++;
+
+    if (usb_hid_flush_mouse_report())
+    {
+        frame_stats.reports++;
+    }
+    usb_hid_flush_keyboard_report();
+    flush_gamepad_reports();
+    flush_mirror_reports();
+}
+
+bool usb_hid_send_mouse_report(uint16_t buttons, int16_t x, int16_t y, int16_t wheel, int16_t pan)
+{
+    const hid_report_layout_t *layout = device_mouse_layout;
+    if (layout == NULL || !tud_hid_n_ready(device_mouse_itf))
+        return false;
+
+
+    uint8_t report[HID_PLAN_MAX_REPORT_BYTES] = {0};
+    const hid_field_t *fields = layout->fields;
+    hid_field_insert(report, &fields[HID_FIELD_BUTTONS], buttons);
+    hid_field_insert(report, &fields[HID_FIELD_X], x);
+    hid_field_insert(report, &fields[HID_FIELD_Y], y);
+    hid_field_insert(report, &fields[HID_FIELD_WHEEL], wheel);
+    hid_field_insert(report, &fields[HID_FIELD_PAN], pan);
+
+    uint8_t const id_bytes = device_mouse_plan.uses_report_ids ? 1 : 0;
+    return tud_hid_n_report(device_mouse_itf, layout->report_id, &report[id_bytes], (uint16_t)(layout->report_bytes - id_bytes));
+}
+
+
+// Mirrored descriptor: the host report is already in the PC's format, so it goes out
+// as received. Only when kmbox has changed something are the pointer fields rewritten,
+// in place, leaving every other bit of the report untouched.
+static void passthrough_report(hid_input_event_t *event)
+{
+    uint8_t *raw = event->raw;
+    uint16_t const len = event->raw_len;
+    uint8_t const id_bytes = device_mouse_plan.uses_report_ids ? 1 : 0;
+    if (len <= id_bytes)
+        return;
+
+    if (staged_report.in_flight || !tud_hid_n_ready(device_mouse_itf))
+    {
+        if (event->has_sample)
+            passthrough_stats.merged++;     // Already in kmbox; the SOF stage sends it
+        else
+            passthrough_stats.dropped++;
+        return;
+    }
+
+    if (!event->has_sample)
+    {
+        if (tud_hid_n_report(device_mouse_itf, id_bytes ? raw[0] : 0, &raw[id_bytes], (uint16_t)(len - id_bytes)))
+        {
+            passthrough_stats.raw++;
+            record_latency(HID_LATENCY_MOUSE, event->received_us);
+        }
+        return;
+    }
+
+
+    uint8_t buttons;
+    int16_t x, y, wheel, pan;
+    kmbox_peek_mouse_report(&buttons, &x, &y, &wheel, &pan);
+
+    hid_mouse_sample_t const *sample = &event->mouse;
+    bool const untouched = buttons == (sample->buttons & 0x1F) && x == sample->x &&
+                           y == sample->y && wheel == sample->wheel && pan == sample->pan;
+    if (!untouched)
+    {
+        const hid_report_layout_t *layout = hid_report_plan_find(&device_mouse_plan, raw, len);
+        if (layout == NULL || len < layout->report_bytes)
+            return;                         // Leave it to the SOF stage
+
+        const hid_field_t *fields = layout->fields;
+        hid_field_insert(raw, &fields[HID_FIELD_BUTTONS], (sample->buttons & ~0x1F) | buttons);
+        hid_field_insert(raw, &fields[HID_FIELD_X], x);
+        hid_field_insert(raw, &fields[HID_FIELD_Y], y);
+        hid_field_insert(raw, &fields[HID_FIELD_WHEEL], wheel);
+        hid_field_insert(raw, &fields[HID_FIELD_PAN], pan);
+    }
+
+    if (!tud_hid_n_report(device_mouse_itf, id_bytes ? raw[0] : 0, &raw[id_bytes], (uint16_t)(len - id_bytes)))
+    {
+        backpressure_stats.send_failures++;
+        return;
+    }
+    if (untouched)
+        passthrough_stats.raw++;
+    else
+        passthrough_stats.patched++;
+    frame_stats.reports++;
+    frame_last_report = frame_stats.frames;
+    settle_input(&mouse_input, HID_LATENCY_MOUSE, true);
+
+
+    staged_report.buttons = buttons;
+    staged_report.x = x;
+    staged_report.y = y;
+    staged_report.wheel = wheel;
+    staged_report.pan = pan;
+    staged_report.in_flight = true;
+}
+
+static void print_device_info(uint8_t dev_addr, const tusb_desc_device_t *desc)
+{
+    (void)dev_addr; // Suppress unused parameter warning
+    if (desc == NULL)
+    {
+        return;
+        return;
+    }
+
+    (void)desc; // suppressed detailed device info logging
+}
+
+// Other interfaces of the attached device get their own endpoint, so they never
+// wait behind pointer traffic and are forwarded exactly as received
+static bool send_mirror_report(uint8_t slot, const uint8_t *data, uint8_t len, uint32_t received_us)
+{
+    mirror_itf_t const *mirror = &mirror_itfs[slot];
+    uint8_t const itf = mirror->device_itf;
+    uint8_t const id_bytes = mirror->uses_report_ids ? 1 : 0;
+    if (!mirror_in.may_send() || !tud_hid_n_ready(itf) ||
+        !tud_hid_n_report(itf, id_bytes ? data[0] : 0, &data[id_bytes], (uint16_t)(len - id_bytes)))
+    {
+        return false;
+    }
+
+    mirror_in.spend();
+    passthrough_stats.mirrored++;
+    mirror_stats.in_reports++;
+    mirror_stats.in_bytes += len;
+    record_latency(HID_LATENCY_OTHER, received_us);
+    return true;
+}
+
+static void forward_itf_report(const hid_input_event_t *event)
+{
+    mirror_itf_t const *mirror = &mirror_itfs[event->slot];
+    if (!mirror->active || mirror->device_itf == DEVICE_ITF_NONE || !tud_mounted() ||
+        event->raw_len <= (mirror->uses_report_ids ? 1 : 0))
+    {
+        return;
+    }
+
+    spsc_queue<mirror_report_t, HID_MIRROR_QUEUE_DEPTH> *queue = &mirror_in_queues[event->slot];
+    if (queue->empty() && send_mirror_report(event->slot, event->raw, event->raw_len, event->received_us))
+    {
+        return;
+    }
+
+    mirror_report_t *report = queue->reserve();
+    if (report == NULL)
+    {
+        passthrough_stats.dropped++;
+        mirror_stats.in_dropped++;
+        return;
+    }
+    report->len = event->raw_len;
+    report->received_us = event->received_us;
+    memcpy(report->data, event->raw, event->raw_len);
+    queue->publish();
+    mirror_stats.in_queued++;
+}
+
+// From the SOF stage, once the mouse and keyboard have had their turn
+static void flush_mirror_reports(void)
+{
+    mirror_in.flush(mirror_in_queues, [](uint8_t slot, const mirror_report_t &report) {
+        if (!mirror_itfs[slot].active || mirror_itfs[slot].device_itf == DEVICE_ITF_NONE)
+        {
+            return MIRROR_DISCARDED;    // Stale; the interface is gone
+        }
+        return send_mirror_report(slot, report.data, report.len, report.received_us) ? MIRROR_SENT : MIRROR_DEFERRED;
+    });
+}
+
+// kmbox input goes over the newest report, so it holds between physical reports
+// and is re-sent on its own when only the kmbox side changed
+static bool send_gamepad_report(uint8_t slot)
+{
+    mirror_itf_t const *mirror = &mirror_itfs[slot];
+    gamepad_path_t *path = &gamepad_paths[slot];
+    uint8_t const itf = mirror->device_itf;
+    uint8_t const id_bytes = mirror->uses_report_ids ? 1 : 0;
+    if (!tud_hid_n_ready(itf))
+    {
+        return false;
+    }
+
+    kmbox_gamepad_t pad;
+    kmbox_get_gamepad(&pad);
+    hid_gamepad_override_t const override = {pad.buttons, pad.axis_mask,
+        {pad.axes[0], pad.axes[1], pad.axes[2], pad.axes[3], pad.axes[4], pad.axes[5], pad.axes[6], pad.axes[7]},
+        pad.hat};
+
+    uint8_t report[HID_PLAN_MAX_REPORT_BYTES];
+    uint8_t const len = path->last.len;
+    memcpy(report, path->last.data, len);
+
+    hid_gamepad_state_t state;
+    if (hid_gamepad_override_active(&override) && hid_gamepad_decode(&mirror->gamepad, report, len, &state))
+    {
+        hid_gamepad_apply_override(&mirror->gamepad, &override, &state);
+        hid_gamepad_encode(&mirror->gamepad, &state, report);
+    }
+
+    if (!tud_hid_n_report(itf, id_bytes ? report[0] : 0, &report[id_bytes], (uint16_t)(len - id_bytes)))
+    {
+        return false;
+    }
+    if (path->pending)
+    {
+        record_latency(HID_LATENCY_GAMEPAD, path->last.received_us);
+    }
+    path->pending = false;
+    path->sequence = pad.sequence;
+    passthrough_stats.mirrored++;
+    return true;
+}
+
+static void forward_gamepad_report(const hid_input_event_t *event)
+{
+    mirror_itf_t const *mirror = &mirror_itfs[event->slot];
+    if (!mirror->active || mirror->device_itf == DEVICE_ITF_NONE || !tud_mounted() ||
+        event->raw_len <= (mirror->uses_report_ids ? 1 : 0))
+    {
+        return;
+    }
+
+    gamepad_path_t *path = &gamepad_paths[event->slot];
+    if (path->pending)
+    {
+        passthrough_stats.merged++;     // Superseded before the endpoint freed up
+    }
+    path->last.len = event->raw_len;
+    path->last.received_us = event->received_us;
+    memcpy(path->last.data, event->raw, event->raw_len);
+    path->pending = true;
+    send_gamepad_report(event->slot);
+}
+
+static void flush_gamepad_reports(void)
+{
+    kmbox_gamepad_t pad;
+    kmbox_get_gamepad(&pad);
+
+    for (uint8_t slot = 0; slot < CFG_TUH_HID; slot++)
+    {
+        mirror_itf_t const *mirror = &mirror_itfs[slot];
+        gamepad_path_t const *path = &gamepad_paths[slot];
+        if (mirror->active && mirror->is_gamepad && mirror->device_itf != DEVICE_ITF_NONE && path->last.len != 0 &&
+            (path->pending || path->sequence != pad.sequence))
+        {
+            send_gamepad_report(slot);
+        }
+    }
+}
+
+static void process_mouse_sample(const hid_mouse_sample_t *report, const scroll_resolution_t *resolution)
+{
+    static uint32_t activity_counter = 0;
+    if (++activity_counter % MOUSE_ACTIVITY_THROTTLE == 0)
+    {
+        neopixel_trigger_mouse_activity();
+    }
+
+
+    if (process_mouse_report_internal(report, resolution))
+    {
+
+    }
+
+
+    if (report->x != 0 || report->y != 0)
+    {
+        neopixel_rainbow_on_movement(report->x, report->y);
+    }
+}
+
+void process_mouse_report(const hid_mouse_sample_t *report)
+{
+    if (report == NULL)
+    {
+        return; // Fast fail without printf for performance
+    }
+
+    static const scroll_resolution_t detents = {1, 1};
+    process_mouse_sample(report, &detents);
+}
+
+bool usb_hid_flush_keyboard_report(void)
+{
+    if (!tud_hid_n_ready(device_keyboard_itf))
+    {
+        return false;
+    }
+
+    hid_key_bitmap_t keys;
+    hid_key_bitmap_merge(&keys, &keyboard_physical, &keyboard_injected);
+    if (hid_key_bitmap_equal(&keys, &keyboard_sent))
+    {
+        settle_input(&keyboard_input, HID_LATENCY_KEYBOARD, false);
+        return false;
+    }
+
+    uint8_t report[HID_KEY_NKRO_REPORT_BYTES];
+    hid_keyboard_encode_nkro(&keys, report);
+    if (!tud_hid_n_report(device_keyboard_itf, 0, report, sizeof(report)))
+    {
+        return false;
+    }
+    keyboard_sent = keys;
+    settle_input(&keyboard_input, HID_LATENCY_KEYBOARD, true);
+    return true;
+}
+
+void usb_hid_set_injected_key(uint8_t usage, bool pressed)
+{
+    hid_key_bitmap_set(&keyboard_injected, usage, pressed);
+    usb_hid_flush_keyboard_report();
+}
+
+static void process_keyboard_state(const hid_key_bitmap_t *keys)
+{
+    static uint32_t activity_counter = 0;
+    if (++activity_counter % KEYBOARD_ACTIVITY_THROTTLE == 0)
+    {
+        neopixel_trigger_keyboard_activity();
+    }
+
+    keyboard_physical = *keys;
+    if (tud_mounted())
+    {
+        usb_hid_flush_keyboard_report(); // A busy endpoint leaves it to the next SOF
+    }
+}
+
+void process_kbd_report(hid_keyboard_report_t const *report)
+{
+    if (report == NULL)
+    {
+        return;
+    }
+
+    hid_key_bitmap_t keys;
+    hid_key_bitmap_clear(&keys);
+    keys.words[HID_KEY_MODIFIER_FIRST >> 5] = (uint32_t)report->modifier << (HID_KEY_MODIFIER_FIRST & 31);
+    for (uint8_t i = 0; i < HID_KEYBOARD_KEYCODE_COUNT; i++)
+    {
+        if (report->keycode[i] != HID_KEY_NONE)
+        {
+            hid_key_bitmap_set(&keys, report->keycode[i], true);
+        }
+    }
+    process_keyboard_state(&keys);
+}
+
+bool find_key_in_report(hid_keyboard_report_t const *report, uint8_t keycode)
+{
+    for (uint8_t i = 0; i < HID_KEYBOARD_KEYCODE_COUNT; i++)
+    {
+        if (report->keycode[i] == keycode)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void update_report_rate(uint32_t current_ms)
+{
+    if (current_ms - report_rate_window_ms < 1000)
+    {
+        return;
+    }
+
+    frame_stats.report_rate = (frame_stats.reports - report_rate_base) * 1000 / (current_ms - report_rate_window_ms);
+    report_rate_base = frame_stats.reports;
+    report_rate_window_ms = current_ms;
+}
+
+void hid_device_task(void)
+{
+
+    static uint32_t start_ms = 0;
+    uint32_t current_ms = to_ms_since_boot(get_absolute_time());
+
+    if (current_ms - start_ms < HID_DEVICE_TASK_INTERVAL_MS)
+    {
+        return; // Not enough time elapsed
+    }
+    start_ms = current_ms;
+
+    update_report_rate(current_ms);
+
+
+    reenumeration_task(current_ms);
+
+
+    // The cache write stalls both cores (see identity_cache_store), so it waits
+    // until nothing is forwarded: the PC side is off the bus for a
+    // re-enumeration, or no device is attached to the host side
+    if (identity_dirty && identity_complete && identity.vid != 0 &&
+        (reenum_state == REENUM_DISCONNECTED || host_itfs_used == 0))
+    {
+        identity_dirty = false;
+        identity_cache_store(&identity);
+        return;
+    }
+
+
+    if (reenum_state == REENUM_DISCONNECTED)
+    {
+        return;
+    }
+
+
+    if (tud_suspended() && !gpio_get(PIN_BUTTON))
+    {
+
+        tud_remote_wakeup();
+        return;
+    }
+
+
+    if (!tud_mounted() || !tud_ready())
+    {
+        return; // Don't queue input if device is not properly mounted
+    }
+
+
+    // Reports themselves go out from the SOF stage, and only when something changed
+    if (!connection_state.mouse_connected)
+    {
+        send_hid_report(REPORT_ID_MOUSE);
+    }
+}
+
+void send_hid_report(uint8_t report_id)
+{
+
+    if (!tud_mounted() || !tud_ready())
+    {
+        return; // Prevent endpoint conflicts by not sending reports when device isn't ready
+    }
+
+    switch (report_id)
+    {
+
+    case REPORT_ID_MOUSE:
+
+        if (!connection_state.mouse_connected && !gpio_get(PIN_BUTTON))
+        {
+
+            kmbox_add_mouse_movement(MOUSE_NO_MOVEMENT, MOUSE_BUTTON_MOVEMENT_DELTA);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Merge stage: every mouse and keyboard on the hub has its own slot, and the PC
+// sees the union of their buttons and keys plus the sum of their motion
+static uint8_t merge_slot_buttons(uint8_t slot, uint8_t buttons)
+{
+    slot_buttons[slot] = buttons;
+
+    uint8_t merged = 0;
+    for (uint8_t i = 0; i < CFG_TUH_HID; i++)
+    {
+        merged |= slot_buttons[i];
+    }
+    return merged;
+}
+
+static void merge_slot_keys(uint8_t slot, const hid_key_bitmap_t *keys)
+{
+    slot_keys[slot] = *keys;
+
+    hid_key_bitmap_t merged = slot_keys[0];
+    for (uint8_t i = 1; i < CFG_TUH_HID; i++)
+    {
+        hid_key_bitmap_merge(&merged, &merged, &slot_keys[i]);
+    }
+    process_keyboard_state(&merged);
+}
+
+static void handle_hid_event(hid_input_event_t *event)
+{
+    switch (event->type)
+    {
+    case HID_EVENT_MOUSE:
+        note_input(&mouse_input, event->received_us);
+        if (event->has_sample)
+        {
+            hid_mouse_sample_t sample = event->mouse;
+            sample.buttons = (uint16_t)((sample.buttons & ~0x1F) | merge_slot_buttons(event->slot, sample.buttons & 0x1F));
+            process_mouse_sample(&sample, &slot_scroll[event->slot]);
+        }
+        if (device_mirrors_host && tud_mounted() && mirror_mouse_ref.valid && event->slot == mirror_mouse_ref.slot)
+        {
+            passthrough_report(event);
+        }
+        break;
+
+    case HID_EVENT_MOUSE_MOUNTED:
+    {
+        host_itf_slot_t const *slot = &host_itf_slots[event->slot];
+        bool const mirrored = build_runtime_hid_report_with_mouse(event->mounted.desc_len ? slot->desc : NULL, event->mounted.desc_len);
+        if (mirrored)
+        {
+            device_mirrors_host = event->mounted.raw_ok;
+        }
+
+        memset(identity.report_desc, 0, sizeof(identity.report_desc));
+        identity.report_desc_len = mirrored ? (uint16_t)desc_hid_runtime_len : 0;
+        identity.raw_ok = device_mirrors_host;
+        memcpy(identity.report_desc, desc_hid_report_runtime, identity.report_desc_len);
+        mirror_mouse_ref = (host_itf_ref_t){true, event->dev_addr, event->instance, event->slot};
+        apply_host_multiplier(slot);
+        update_identity_endpoints();
+        note_identity_change();
+        check_device_interfaces();
+        break;
+    }
+
+    case HID_EVENT_DEVICE_MOUNTED:
+        set_attached_device_vid_pid(event->identity.vid, event->identity.pid);
+        check_device_interfaces();
+        break;
+
+    case HID_EVENT_STRINGS_READY:
+        // Strings that land inside the settle window ride along with that
+        // re-enumeration; later ones only cost another if they changed
+        memcpy(identity.strings, fetched_strings, sizeof(identity.strings));
+        identity_complete = true;
+        note_identity_change();
+        break;
+
+    case HID_EVENT_UNMOUNTED:
+
+        kmbox_update_physical_buttons(merge_slot_buttons(event->slot, 0));
+        host_eps[event->slot] = (host_ep_t){0, 0};
+        slot_scroll[event->slot] = (scroll_resolution_t){1, 1};
+        if (mirror_mouse_ref.slot == event->slot)
+        {
+            mirror_mouse_ref.valid = false;
+        }
+        break;
+
+    case HID_EVENT_KEYBOARD_MOUNTED:
+        mirror_keyboard_ref = (host_itf_ref_t){true, event->dev_addr, event->instance, event->slot};
+        update_identity_endpoints();
+        note_identity_change();
+        check_device_interfaces();
+        break;
+
+    case HID_EVENT_REPORT_FETCHED:
+        answer_forwarded_get(event);
+        break;
+
+    case HID_EVENT_SCROLL_RESOLUTION:
+        slot_scroll[event->slot] = slot_scroll_pending[event->slot];
+        break;
+
+    case HID_EVENT_ENDPOINT:
+        host_eps[event->slot] = event->endpoint;
+        update_identity_endpoints();
+        note_identity_change();
+        check_device_interfaces();
+        break;
+
+    case HID_EVENT_ITF_MOUNTED:
+    {
+        host_itf_slot_t const *slot = &host_itf_slots[event->slot];
+        mirror_itf_t *mirror = &mirror_itfs[event->slot];
+        mirror->active = true;
+        mirror->dev_addr = event->dev_addr;
+        mirror->instance = event->instance;
+        mirror->uses_report_ids = slot->uses_report_ids;
+        mirror->has_out = slot->has_out;
+        mirror->desc_len = slot->desc_len;
+        memcpy(mirror->desc, slot->desc, slot->desc_len);
+        mirror->is_gamepad = slot->is_gamepad;
+        mirror->gamepad = slot->gamepad;
+        memset(&gamepad_paths[event->slot], 0, sizeof(gamepad_paths[event->slot]));
+        check_device_interfaces();
+        break;
+    }
+
+    case HID_EVENT_ITF_UNMOUNTED:
+        mirror_itfs[event->slot].active = false;
+        gamepad_paths[event->slot].pending = false;
+        host_eps[event->slot] = (host_ep_t){0, 0};
+        while (mirror_in_queues[event->slot].front() != NULL)
+        {
+            mirror_in_queues[event->slot].pop_front();
+        }
+        break;
+
+    case HID_EVENT_ITF_REPORT:
+        forward_itf_report(event);
+        break;
+
+    case HID_EVENT_GAMEPAD:
+        forward_gamepad_report(event);
+        break;
+
+    case HID_EVENT_KEYBOARD:
+        note_input(&keyboard_input, event->received_us);
+        merge_slot_keys(event->slot, &event->keys);
+        break;
+
+    case HID_EVENT_KEYBOARD_UNMOUNTED:
+    {
+        hid_key_bitmap_t released;
+        hid_key_bitmap_clear(&released);
+        merge_slot_keys(event->slot, &released);
+        host_eps[event->slot] = (host_ep_t){0, 0};
+        if (mirror_keyboard_ref.slot == event->slot)
+        {
+            mirror_keyboard_ref.valid = false;
+        }
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+// Handled in the slot itself so the raw report is never copied again on this side
+static void handle_queued_hid_events(void)
+{
+    hid_input_event_t *event;
+    while ((event = hid_event_queue.front()) != NULL)
+    {
+        handle_hid_event(event);
+        hid_event_queue.pop_front();
+        hid_events_popped++;
+    }
+}
+
+void hid_event_task(void)
+{
+
+    while (multicore_fifo_rvalid())
+    {
+        if (multicore_fifo_pop_blocking() == HID_EVENT_DOORBELL)
+        {
+            hid_doorbells++;
+        }
+    }
+
+
+    if (!hid_event_queue.empty())
+    {
+        handle_queued_hid_events();
+    }
+    expire_forwarded_get();
+}
+
+void usb_hid_get_frame_stats(hid_frame_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = frame_stats;
+    }
+}
+
+void usb_hid_get_backpressure_stats(hid_backpressure_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = backpressure_stats;
+        kmbox_get_motion_totals(&stats->fed_x, &stats->fed_y, &stats->pending_x, &stats->pending_y);
+    }
+}
+
+void usb_hid_get_passthrough_stats(hid_passthrough_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = passthrough_stats;
+    }
+}
+
+void usb_hid_get_enumeration_stats(hid_enumeration_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = enumeration_stats;
+    }
+}
+
+void usb_hid_get_event_stats(hid_event_stats_t *stats)
+{
+    if (stats == NULL)
+    {
+        return;
+    }
+
+    stats->pushed = hid_event_queue.pushed();
+    stats->popped = hid_events_popped;
+    stats->drops = hid_event_queue.drops();
+    stats->depth = hid_event_queue.depth();
+    stats->high_water = hid_event_queue.high_water();
+    stats->doorbells = hid_doorbells;
+}
+
+void usb_hid_get_forward_stats(hid_forward_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = forward_stats;
+    }
+}
+
+void usb_hid_get_mirror_stats(hid_mirror_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = mirror_stats;
+    }
+}
+
+void usb_hid_get_latency_stats(hid_latency_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = latency_stats;
+    }
+}
+
+void usb_hid_get_poll_stats(hid_poll_stats_t *stats)
+{
+    if (stats != NULL)
+    {
+        *stats = poll_stats;
+    }
+}
+
+// What the host side actually delivers, as opposed to what the PC is sent
+static void update_input_rate(uint32_t current_ms)
+{
+    uint32_t const elapsed_ms = current_ms - input_rate_window_ms;
+    if (elapsed_ms < 1000)
+    {
+        return;
+    }
+
+    poll_stats.mouse_rate = (host_mouse_report_count - input_rate_mouse_base) * 1000 / elapsed_ms;
+    poll_stats.input_rate = (host_input_report_count - input_rate_base) * 1000 / elapsed_ms;
+    input_rate_mouse_base = host_mouse_report_count;
+    input_rate_base = host_input_report_count;
+    input_rate_window_ms = current_ms;
+}
+
+void hid_host_task(void)
+{
+    identity_fetch_task();
+    hid_request_task();
+    mirror_out_task();
+    update_input_rate(to_ms_since_boot(get_absolute_time()));
+}
+
+
+// Linked in place of the host driver's hcd_edpt_open (--wrap). Many mice advertise
+// 8 or 10 ms yet answer every frame, so interrupt IN endpoints are opened with the
+// shorter of their bInterval and HID_HOST_POLL_INTERVAL_MS. Hubs keep theirs; their
+// addresses sit above CFG_TUH_DEVICE_MAX.
+extern "C" bool __real_hcd_edpt_open(uint8_t rhport, uint8_t daddr, tusb_desc_endpoint_t const *ep_desc);
+
+extern "C" bool __wrap_hcd_edpt_open(uint8_t rhport, uint8_t daddr, tusb_desc_endpoint_t const *ep_desc)
+{
+    if (HID_HOST_POLL_INTERVAL_MS == 0 || ep_desc == NULL || daddr == 0 || daddr > CFG_TUH_DEVICE_MAX ||
+        ep_desc->bmAttributes.xfer != TUSB_XFER_INTERRUPT || tu_edpt_dir(ep_desc->bEndpointAddress) != TUSB_DIR_IN ||
+        ep_desc->bInterval <= HID_HOST_POLL_INTERVAL_MS)
+    {
+        return __real_hcd_edpt_open(rhport, daddr, ep_desc);
+    }
+
+    tusb_desc_endpoint_t desc = *ep_desc;
+    desc.bInterval = HID_HOST_POLL_INTERVAL_MS;
+    poll_stats.overridden++;
+    poll_stats.advertised_ms = ep_desc->bInterval;
+    poll_stats.applied_ms = desc.bInterval;
+    return __real_hcd_edpt_open(rhport, daddr, &desc);
+}
+
+
+void tud_mount_cb(void)
+{
+
+    tud_sof_cb_enable(true);
+
+    led_set_blink_interval(LED_BLINK_MOUNTED_MS);
+    neopixel_update_status();
+}
+
+void tud_umount_cb(void)
+{
+    led_set_blink_interval(LED_BLINK_UNMOUNTED_MS);
+
+
+    if (staged_report.in_flight)
+    {
+        staged_report.in_flight = false;
+        backpressure_stats.aborted++;
+    }
+    idle_interval_ms = 0;
+
+
+    usb_error_tracker.consecutive_device_errors++;
+
+    neopixel_update_status();
+}
 
-    if (report->wheel != 0)
-        kmbox_add_wheel_movement(report->wheel);
+void tud_suspend_cb(bool remote_wakeup_en)
+{
+    (void)remote_wakeup_en;
+    led_set_blink_interval(LED_BLINK_SUSPENDED_MS);
+    neopixel_update_status();
+}
 
-    uint8_t buttons_to_send;
-    int8_t x, y, wheel, pan;
-    kmbox_get_mouse_report(&buttons_to_send, &x, &y, &wheel, &pan);
+void tud_resume_cb(void)
+{
+    led_set_blink_interval(LED_BLINK_RESUMED_MS);
+    neopixel_update_status();
+}
 
-    int8_t final_x = x;
-    int8_t final_y = y;
-    int8_t final_wheel = wheel;
 
-    if (!tud_hid_ready())
-        return false;
+void tuh_mount_cb(uint8_t dev_addr)
+{
 
-    return tud_hid_mouse_report(REPORT_ID_MOUSE, buttons_to_send, final_x, final_y, final_wheel, pan);
+    neopixel_trigger_usb_connection_flash();
+    neopixel_update_status();
 }
 
-static void print_device_info(uint8_t dev_addr, const tusb_desc_device_t *desc)
+void tuh_umount_cb(uint8_t dev_addr)
 {
-    (void)dev_addr; // Suppress unused parameter warning
-    if (desc == NULL)
+
+
+    handle_device_disconnection(dev_addr);
+
+
+    static uint32_t last_unmount_time = 0;
+    uint32_t current_time = to_ms_since_boot(get_absolute_time());
+
+    if (current_time - last_unmount_time < 5000)
+    { // Less than 5 seconds since last unmount
+        usb_error_tracker.consecutive_host_errors++;
+
+    }
+    else
     {
-        return;
-        return;
+
+        usb_error_tracker.consecutive_host_errors = 0;
     }
+    last_unmount_time = current_time;
 
-    (void)desc; // suppressed detailed device info logging
+
+    neopixel_trigger_usb_disconnection_flash();
+    neopixel_update_status();
 }
 
-void process_mouse_report(const hid_mouse_report_t *report)
+
+static uint8_t primary_dev_addr(void)
 {
-    if (report == NULL)
+    if (connection_state.mouse_connected)
+        return connection_state.mouse_dev_addr;
+    if (connection_state.keyboard_connected)
+        return connection_state.keyboard_dev_addr;
+    return 0;
+}
+
+static inline host_itf_slot_t *find_host_itf_slot(uint8_t dev_addr, uint8_t instance)
+{
+    if (dev_addr > HOST_DEV_ADDR_MAX || instance >= CFG_TUH_HID)
     {
-        return; // Fast fail without printf for performance
+        return NULL;
     }
 
-    static uint32_t activity_counter = 0;
-    if (++activity_counter % MOUSE_ACTIVITY_THROTTLE == 0)
+    uint8_t const index = host_slot_lookup[dev_addr][instance];
+    return index ? &host_itf_slots[index - 1] : NULL;
+}
+
+static host_itf_slot_t *claim_host_itf_slot(uint8_t dev_addr, uint8_t instance)
+{
+    if (dev_addr > HOST_DEV_ADDR_MAX || instance >= CFG_TUH_HID)
     {
-        neopixel_trigger_mouse_activity();
+        return NULL;
     }
 
+    for (uint8_t index = 0; index < CFG_TUH_HID; index++)
+    {
+        host_itf_slot_t *slot = &host_itf_slots[index];
+        if (!slot->used)
+        {
+            memset(slot, 0, sizeof(*slot));
+            slot->used = true;
+            slot->index = index;
+            host_itfs_used++;
+            slot->dev_addr = dev_addr;
+            slot->instance = instance;
+            host_slot_lookup[dev_addr][instance] = (uint8_t)(index + 1);
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+static void post_slot_event(uint8_t type, const host_itf_slot_t *slot)
+{
+    hid_input_event_t event = {};
+    event.type = type;
+    event.dev_addr = slot->dev_addr;
+    event.instance = slot->instance;
+    event.slot = slot->index;
+    if (type == HID_EVENT_MOUSE_MOUNTED)
+    {
+        event.mounted.desc_len = slot->desc_len;
+        event.mounted.raw_ok = slot->raw_ok;
+    }
+    post_hid_event(&event);
+}
 
-    if (process_mouse_report_internal(report))
+// The first mouse and the first keyboard are primary: the PC sees the primary
+// mouse's descriptor and the primary device's identity. Every other slot only
+// feeds the merge stage on core 0.
+static void promote_primary_interfaces(void)
+{
+    for (uint8_t index = 0; index < CFG_TUH_HID; index++)
     {
+        host_itf_slot_t const *slot = &host_itf_slots[index];
+        if (!slot->used)
+        {
+            continue;
+        }
 
+        if (slot->is_mouse && !connection_state.mouse_connected)
+        {
+            handle_hid_device_connection(slot->dev_addr, slot->instance, index, true, false);
+            post_slot_event(HID_EVENT_MOUSE_MOUNTED, slot);
+        }
+        if (slot->is_keyboard && !connection_state.keyboard_connected)
+        {
+            handle_hid_device_connection(slot->dev_addr, slot->instance, index, false, true);
+            post_slot_event(HID_EVENT_KEYBOARD_MOUNTED, slot);
+        }
     }
+}
 
+static void post_strings_ready(uint8_t dev_addr)
+{
+    hid_input_event_t event = {};
+    event.type = HID_EVENT_STRINGS_READY;
+    event.dev_addr = dev_addr;
+    post_hid_event(&event);
+}
 
-    if (report->x != 0 || report->y != 0)
+static void apply_slot_endpoint(const host_itf_slot_t *slot)
+{
+    for (uint8_t i = 0; i < identity_fetch.endpoint_count; i++)
     {
-        neopixel_rainbow_on_movement(report->x, report->y);
+        if (identity_fetch.endpoints[i].itf_num == slot->itf_num)
+        {
+            hid_input_event_t event = {};
+            event.type = HID_EVENT_ENDPOINT;
+            event.dev_addr = slot->dev_addr;
+            event.instance = slot->instance;
+            event.slot = slot->index;
+            event.endpoint.size = identity_fetch.endpoints[i].size;
+            event.endpoint.interval = identity_fetch.endpoints[i].interval;
+            post_hid_event(&event);
+            return;
+        }
     }
 }
 
-void hid_device_task(void)
+static void apply_fetched_endpoints(uint8_t dev_addr)
 {
+    for (uint8_t index = 0; index < CFG_TUH_HID; index++)
+    {
+        if (host_itf_slots[index].used && host_itf_slots[index].dev_addr == dev_addr)
+        {
+            apply_slot_endpoint(&host_itf_slots[index]);
+        }
+    }
+}
 
-    static uint32_t start_ms = 0;
-    uint32_t current_ms = to_ms_since_boot(get_absolute_time());
+static void announce_primary_device(uint8_t previous_primary)
+{
+    uint8_t const dev_addr = primary_dev_addr();
+    if (dev_addr == previous_primary)
+    {
+        return;
+    }
 
-    if (current_ms - start_ms < HID_DEVICE_TASK_INTERVAL_MS)
+    reset_device_identity();
+    if (dev_addr == 0)
     {
-        return; // Not enough time elapsed
+        return;
     }
-    start_ms = current_ms;
 
+    uint16_t vid, pid;
+    tuh_vid_pid_get(dev_addr, &vid, &pid);
+    fetch_device_identity(dev_addr);
+
+    hid_input_event_t event = {};
+    event.type = HID_EVENT_DEVICE_MOUNTED;
+    event.dev_addr = dev_addr;
+    event.identity.vid = vid;
+    event.identity.pid = pid;
+    post_hid_event(&event);
+}
 
-    if (tud_suspended() && !gpio_get(PIN_BUTTON))
+static void release_host_itf_slot(host_itf_slot_t *slot)
+{
+    if (slot->is_keyboard)
+        post_slot_event(HID_EVENT_KEYBOARD_UNMOUNTED, slot);
+    if (slot->is_mouse)
+        post_slot_event(HID_EVENT_UNMOUNTED, slot);
+    if ((!slot->is_mouse && !slot->is_keyboard) || slot->mirrors_extra)
+        post_slot_event(HID_EVENT_ITF_UNMOUNTED, slot);
+
+    if (connection_state.mouse_connected && connection_state.mouse_slot == slot->index)
     {
+        connection_state.mouse_connected = false;
+    }
+    if (connection_state.keyboard_connected && connection_state.keyboard_slot == slot->index)
+    {
+        connection_state.keyboard_connected = false;
+    }
 
-        tud_remote_wakeup();
-        return;
+    host_slot_lookup[slot->dev_addr][slot->instance] = 0;
+    slot->used = false;
+    host_itfs_used--;
+}
+
+// Composite keyboards put Consumer and System Control reports on the keyboard
+// interface; those go out unchanged on a mirror of it, beside the NKRO keyboard
+static bool plan_has_non_key_input(const hid_report_plan_t *plan)
+{
+    for (uint8_t r = 0; r < plan->report_count; r++)
+    {
+        if (!plan->reports[r].has_keyboard && !plan->reports[r].has_pointer)
+        {
+            return true;
+        }
     }
+    return plan->report_count >= HID_PLAN_MAX_REPORTS;   // More reports than the plan could hold
+}
+
+void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, const uint8_t *desc_report, uint16_t desc_len)
+{
+    uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
+    uint8_t const previous_primary = primary_dev_addr();
 
+    host_itf_slot_t *slot = claim_host_itf_slot(dev_addr, instance);
+    if (slot == NULL)
+    {
+        neopixel_update_status();
+        return; // Every slot taken; the interface stays silent
+    }
+    slot->mount_us = time_us_32();
+    enumeration_stats.mounts++;
 
-    if (!tud_mounted() || !tud_ready())
+    tuh_itf_info_t itf_info;
+    if (tuh_hid_itf_get_info(dev_addr, instance, &itf_info))
     {
-        return; // Don't send reports if device is not properly mounted
+        slot->itf_num = itf_info.desc.bInterfaceNumber;
+        slot->has_out = itf_info.desc.bNumEndpoints >= 2;
     }
 
 
-    if (!connection_state.mouse_connected)
+    hid_report_plan_t plan;
+    bool const boot_protocol = (itf_protocol != HID_ITF_PROTOCOL_NONE) &&
+                               (tuh_hid_get_protocol(dev_addr, instance) == HID_PROTOCOL_BOOT);
+    bool const desc_usable = !boot_protocol && desc_report != NULL && desc_len > 0;
+    bool const desc_parsed = desc_usable && hid_parse_report_descriptor(desc_report, desc_len, &plan);
+    slot->uses_report_ids = desc_usable && plan.uses_report_ids;
+
+    if (desc_report != NULL && desc_len > 0 && desc_len <= sizeof(slot->desc))
     {
-        send_hid_report(REPORT_ID_MOUSE);
+        memcpy(slot->desc, desc_report, desc_len);
+        slot->desc_len = desc_len;
+    }
+
+
+    if (desc_parsed && hid_report_plan_has_keyboard(&plan))
+    {
+        slot->keyboard = plan;
+        slot->is_keyboard = true;
+        slot->mirrors_extra = slot->desc_len != 0 && plan_has_non_key_input(&plan);
+    }
+    else if (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD)
+    {
+        hid_report_plan_init_boot_keyboard(&slot->keyboard);
+        slot->is_keyboard = true;
+    }
+
+    bool parsed = desc_parsed && hid_report_plan_has_pointer(&plan);
+    slot->raw_ok = parsed && slot->desc_len != 0;
+    if (!parsed && itf_protocol == HID_ITF_PROTOCOL_MOUSE)
+    {
+        hid_report_plan_init_boot_mouse(&plan);
+        parsed = true;
+    }
+
+    slot->is_mouse = parsed && (itf_protocol == HID_ITF_PROTOCOL_MOUSE || !connection_state.mouse_connected);
+    if (slot->is_mouse)
+    {
+        hid_mouse_decoder_init(&slot->mouse, &plan, desc_report, desc_len);
+    }
+    else if (!slot->is_keyboard && desc_parsed && plan.gamepad.present && slot->desc_len != 0)
+    {
+        slot->gamepad = plan.gamepad;
+        slot->is_gamepad = true;
+    }
+
+
+    if ((!slot->is_mouse && !slot->is_keyboard) || slot->mirrors_extra)
+    {
+        if (slot->desc_len != 0)
+            post_slot_event(HID_EVENT_ITF_MOUNTED, slot);
+    }
+    promote_primary_interfaces();
+    announce_primary_device(previous_primary);
+    if (identity_fetch.endpoints_ready && identity_fetch.dev_addr == dev_addr)
+    {
+        apply_slot_endpoint(slot);  // Later interface of a device whose configuration is already known
+    }
+
+    if (slot->is_mouse)
+        neopixel_trigger_mouse_activity(); // Flash magenta for mouse connection
+    if (slot->is_keyboard)
+        neopixel_trigger_keyboard_activity();
+
+
+    if (!tuh_hid_receive_report(dev_addr, instance))
+    {
+
+        neopixel_trigger_usb_disconnection_flash();
     }
     else
     {
 
-        send_hid_report(REPORT_ID_CONSUMER_CONTROL);
+        neopixel_update_status();
     }
+    neopixel_update_status();
 }
 
-void send_hid_report(uint8_t report_id)
+void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance)
 {
+    uint8_t const previous_primary = primary_dev_addr();
+    drop_hid_request_for(dev_addr, instance);
 
-    if (!tud_mounted() || !tud_ready())
+    host_itf_slot_t *slot = find_host_itf_slot(dev_addr, instance);
+    if (slot != NULL)
     {
-        return; // Prevent endpoint conflicts by not sending reports when device isn't ready
+        release_host_itf_slot(slot);
+        promote_primary_interfaces();
+        announce_primary_device(previous_primary);
     }
 
 
-    static uint32_t last_mount_check = 0;
-    uint32_t current_time = to_ms_since_boot(get_absolute_time());
-    if (current_time - last_mount_check > 1000)
-    { // Check every second
-        if (!tud_mounted())
+    neopixel_trigger_usb_disconnection_flash();
+    neopixel_update_status();
+}
+
+void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, const uint8_t *report, uint16_t len)
+{
+
+    uint32_t const received_us = time_us_32();
+    host_itf_slot_t *slot = find_host_itf_slot(dev_addr, instance);
+    if (report == NULL || len == 0 || slot == NULL)
+    {
+        tuh_hid_receive_report(dev_addr, instance);
+        return;
+    }
+    host_input_report_count++;
+
+    if (!slot->reported)
+    {
+        uint32_t const latency_us = time_us_32() - slot->mount_us;
+        slot->reported = true;
+        enumeration_stats.first_reports++;
+        enumeration_stats.last_first_report_us = latency_us;
+        if (latency_us > enumeration_stats.max_first_report_us)
         {
-            return; // Device was unmounted, don't send reports
+            enumeration_stats.max_first_report_us = latency_us;
         }
-        last_mount_check = current_time;
     }
 
-    switch (report_id)
+    if (slot->is_keyboard)
     {
-
-    case REPORT_ID_MOUSE:
-
-        if (!connection_state.mouse_connected)
+        hid_key_bitmap_t keys;
+        if (hid_keyboard_decode(&slot->keyboard, report, len, &keys))
         {
-
-            if (tud_hid_ready())
+            hid_input_event_t *event = hid_event_queue.reserve();
+            if (event != NULL)
             {
-                static bool prev_button_state = true; // true = not pressed (active low)
-                bool current_button_state = gpio_get(PIN_BUTTON);
-
-                if (!current_button_state)
-                { // button pressed (active low)
-
-                    tud_hid_mouse_report(REPORT_ID_MOUSE, MOUSE_BUTTON_NONE,
-                                         MOUSE_NO_MOVEMENT, MOUSE_BUTTON_MOVEMENT_DELTA,
-                                         MOUSE_NO_MOVEMENT, MOUSE_NO_MOVEMENT);
-                }
-                else if (prev_button_state != current_button_state)
-                {
-
-                    tud_hid_mouse_report(REPORT_ID_MOUSE, MOUSE_BUTTON_NONE,
-                                         MOUSE_NO_MOVEMENT, MOUSE_NO_MOVEMENT,
-                                         MOUSE_NO_MOVEMENT, MOUSE_NO_MOVEMENT);
-                }
-
-                prev_button_state = current_button_state;
+                event->type = HID_EVENT_KEYBOARD;
+                event->dev_addr = dev_addr;
+                event->instance = instance;
+                event->slot = slot->index;
+                event->has_sample = false;
+                event->raw_len = 0;
+                event->received_us = received_us;
+                event->keys = keys;
+                hid_event_queue.publish();
+                ring_hid_doorbell();
             }
+            tuh_hid_receive_report(dev_addr, instance);
+            return;
         }
-        break;
+        // A key report that failed to decode never goes to the mirror, where
+        // nothing would ever release its keys
+        const hid_report_layout_t *layout = hid_report_plan_find(&slot->keyboard, report, len);
+        if (!slot->is_mouse && (!slot->mirrors_extra || (layout != NULL && layout->has_keyboard)))
+        {
+            mirror_stats.in_unrouted++;
+            tuh_hid_receive_report(dev_addr, instance);
+            return;
+        }
+    }
 
-    case REPORT_ID_CONSUMER_CONTROL:
+    // Consumer and system keys from a keyboard interface are key events too, so
+    // they are not throttled
+    bool const is_mirrored = !slot->is_mouse && !slot->is_keyboard && !slot->is_gamepad;
+    if (!mirror_admit(hid_event_queue.depth(), is_mirrored))
     {
+        mirror_stats.in_throttled++;    // The rest of the queue is kept for pointer, key and gamepad events
+    }
+    else
+    {
+        // The host buffer is reused for the next transfer, so this one copy into the
+        // queue slot is the only one the report gets before it reaches the endpoint
+        hid_input_event_t *event = hid_event_queue.reserve();
+        if (event != NULL)
+        {
+            uint16_t const raw_len = TU_MIN(len, (uint16_t)sizeof(event->raw));
+            memcpy(event->raw, report, raw_len);
+            event->raw_len = (uint8_t)raw_len;
+            event->received_us = received_us;
+            event->type = slot->is_mouse ? HID_EVENT_MOUSE : slot->is_gamepad ? HID_EVENT_GAMEPAD : HID_EVENT_ITF_REPORT;
+            event->dev_addr = dev_addr;
+            event->instance = instance;
+            event->slot = slot->index;
+            event->has_sample = slot->is_mouse && hid_mouse_decoder_decode(&slot->mouse, report, len, &event->mouse);
+            hid_event_queue.publish();
+            ring_hid_doorbell();
+        }
 
-        if (tud_hid_ready())
+        if (slot->is_mouse && (++host_mouse_report_count % HID_DECODER_PROFILE_INTERVAL) == 0)
         {
-            static const uint16_t empty_key = 0;
-            tud_hid_report(REPORT_ID_CONSUMER_CONTROL, &empty_key, HID_CONSUMER_CONTROL_SIZE);
+            hid_mouse_decoder_profile(&slot->mouse, report, len);
         }
-        break;
     }
 
-    default:
-        break;
-    }
+
+    tuh_hid_receive_report(dev_addr, instance);
 }
 
-void hid_host_task(void)
-{
 
+// Core 1 side of the mirror OUT queues: one report per pass at most, round-robin
+// across interfaces. TinyUSB copies the report, so it leaves the queue once accepted.
+static void mirror_out_task(void)
+{
+    mirror_out.run(time_us_32(), mirror_out_queues, [](uint8_t slot, const mirror_report_t &report) {
+        (void)slot;
+        if (find_host_itf_slot(report.dev_addr, report.instance) == NULL)
+        {
+            mirror_stats.out_orphaned++;
+            return MIRROR_DISCARDED;
+        }
+        if (!tuh_hid_send_ready(report.dev_addr, report.instance) ||
+            !tuh_hid_send_report(report.dev_addr, report.instance, 0, report.data, report.len))
+        {
+            mirror_stats.out_deferred++;
+            return MIRROR_DEFERRED;
+        }
 
+        mirror_stats.out_reports++;
+        mirror_stats.out_bytes += report.len;
+        return MIRROR_SENT;
+    });
 }
 
 
-void tud_mount_cb(void)
+// Core 1 side of the request queue. The front request is moved out of the queue
+// into current, which TinyUSB sends from and receives into, and stays there
+// until its transfer has really ended: completed, aborted, or its device gone.
+static struct
 {
-    led_set_blink_interval(LED_BLINK_MOUNTED_MS);
-    neopixel_update_status();
+    bool active;                            // current holds a request
+    bool in_flight;                         // and TinyUSB owns a transfer for it
+    hid_request_t current;
+    uint8_t dev_addr;
+    uint8_t instance;
+    uint8_t next_slot;                      // SET_LEDS: next host slot to visit
+    uint8_t led_report[2];                  // SET_LEDS: data stage for the current keyboard
+    uint32_t started_ms;
+} hid_request_state;
+
+// Report ID first, as the attached device sent it; no data tells core 0 to stall
+static void post_get_answer(const hid_request_t *request, const uint8_t *data, uint16_t len)
+{
+    hid_input_event_t event = {};
+    event.type = HID_EVENT_REPORT_FETCHED;
+    event.dev_addr = request->dev_addr;
+    event.instance = request->instance;
+    event.fetched.seq = request->seq;
+    event.raw_len = (uint8_t)TU_MIN(len, (uint16_t)sizeof(event.raw));
+    if (data != NULL)
+    {
+        memcpy(event.raw, data, event.raw_len);
+    }
+    post_hid_event(&event);
 }
 
-void tud_umount_cb(void)
+static void finish_hid_request(void)
 {
-    led_set_blink_interval(LED_BLINK_UNMOUNTED_MS);
-
+    hid_request_state.active = false;
+    hid_request_state.in_flight = false;
+    hid_request_state.next_slot = 0;
+}
 
-    usb_error_tracker.consecutive_device_errors++;
+static void fail_hid_request(void)
+{
+    if (hid_request_state.current.kind == HID_REQUEST_GET)
+    {
+        post_get_answer(&hid_request_state.current, NULL, 0);
+    }
+    finish_hid_request();
+}
 
-    neopixel_update_status();
+static bool issue_hid_request(hid_request_t *request, uint8_t dev_addr, uint8_t instance, uint8_t report_id,
+                              uint8_t *data, uint16_t len)
+{
+    bool const issued = request->kind == HID_REQUEST_GET
+                            ? tuh_hid_get_report(dev_addr, instance, report_id, request->report_type, data, len)
+                            : tuh_hid_set_report(dev_addr, instance, report_id, request->report_type, data, len);
+    if (issued)
+    {
+        hid_request_state.in_flight = true;
+        hid_request_state.dev_addr = dev_addr;
+        hid_request_state.instance = instance;
+        hid_request_state.started_ms = to_ms_since_boot(get_absolute_time());
+    }
+    return issued; // Control pipe busy otherwise; retried on the next pass
 }
 
-void tud_suspend_cb(bool remote_wakeup_en)
+static void hid_request_task(void)
 {
-    (void)remote_wakeup_en;
-    led_set_blink_interval(LED_BLINK_SUSPENDED_MS);
-    neopixel_update_status();
+    if (!hid_request_state.active)
+    {
+        if (!hid_request_queue.pop(&hid_request_state.current))
+        {
+            return;
+        }
+        hid_request_state.active = true;
+    }
+    hid_request_t *request = &hid_request_state.current;
+
+    if (hid_request_state.in_flight)
+    {
+        if (to_ms_since_boot(get_absolute_time()) - hid_request_state.started_ms >= HID_REQUEST_TIMEOUT_MS)
+        {
+            // The control pipe is only free again once the transfer is aborted
+            forward_stats.timeouts++;
+            tuh_edpt_abort_xfer(hid_request_state.dev_addr, 0);
+            fail_hid_request();
+        }
+        return;
+    }
+
+    if (request->kind == HID_REQUEST_SET_LEDS)
+    {
+        for (uint8_t index = hid_request_state.next_slot; index < CFG_TUH_HID; index++)
+        {
+            host_itf_slot_t *slot = &host_itf_slots[index];
+            if (!slot->used || !slot->is_keyboard || !slot->keyboard.has_leds)
+            {
+                continue;
+            }
+
+            // Data stage carries the report ID first when the keyboard uses one
+            uint8_t const report_id = slot->keyboard.led_report_id;
+            uint8_t *data = hid_request_state.led_report;
+            data[0] = report_id;
+            data[report_id ? 1 : 0] = request->data[0];
+            if (issue_hid_request(request, slot->dev_addr, slot->instance, report_id, data, (uint16_t)(report_id ? 2 : 1)))
+            {
+                hid_request_state.next_slot = (uint8_t)(index + 1);
+            }
+            return;
+        }
+        finish_hid_request();
+        return;
+    }
+
+    if (find_host_itf_slot(request->dev_addr, request->instance) == NULL)
+    {
+        forward_stats.orphaned++;
+        fail_hid_request();
+        return;
+    }
+    issue_hid_request(request, request->dev_addr, request->instance, request->report_id, request->data, request->len);
 }
 
-void tud_resume_cb(void)
+static bool hid_request_matches(uint8_t dev_addr, uint8_t instance)
 {
-    led_set_blink_interval(LED_BLINK_RESUMED_MS);
-    neopixel_update_status();
+    return hid_request_state.in_flight && hid_request_state.dev_addr == dev_addr &&
+           hid_request_state.instance == instance;
 }
 
-
-void tuh_mount_cb(uint8_t dev_addr)
+// The device took its transfer with it; no completion will come
+static void drop_hid_request_for(uint8_t dev_addr, uint8_t instance)
 {
-
-    neopixel_trigger_usb_connection_flash();
-    neopixel_update_status();
+    if (hid_request_matches(dev_addr, instance))
+    {
+        forward_stats.orphaned++;
+        fail_hid_request();
+    }
 }
 
-void tuh_umount_cb(uint8_t dev_addr)
+void tuh_hid_set_report_complete_cb(uint8_t dev_addr, uint8_t instance, uint8_t report_id, uint8_t report_type, uint16_t len)
 {
+    (void)report_id;
+    (void)report_type;
 
+    if (!hid_request_matches(dev_addr, instance))
+    {
+        return; // Already timed out
+    }
 
-    handle_device_disconnection(dev_addr);
-
-
-    static uint32_t last_unmount_time = 0;
-    uint32_t current_time = to_ms_since_boot(get_absolute_time());
-
-    if (current_time - last_unmount_time < 5000)
-    { // Less than 5 seconds since last unmount
-        usb_error_tracker.consecutive_host_errors++;
+    if (len != 0)
+        forward_stats.forwarded++;
+    else
+        forward_stats.failed++;
 
+    hid_request_state.in_flight = false;
+    uint8_t const kind = hid_request_state.current.kind;
+    if (kind == HID_REQUEST_SET_MULTIPLIER && len != 0)
+    {
+        host_itf_slot_t const *slot = find_host_itf_slot(dev_addr, instance);
+        if (slot != NULL)
+        {
+            post_slot_event(HID_EVENT_SCROLL_RESOLUTION, slot);
+        }
     }
-    else
+    if (kind != HID_REQUEST_SET_LEDS)
     {
-
-        usb_error_tracker.consecutive_host_errors = 0;
+        finish_hid_request();
     }
-    last_unmount_time = current_time;
-
-
-    neopixel_trigger_usb_disconnection_flash();
-    neopixel_update_status();
 }
 
-
-void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, const uint8_t *desc_report, uint16_t desc_len)
+void tuh_hid_get_report_complete_cb(uint8_t dev_addr, uint8_t instance, uint8_t report_id, uint8_t report_type, uint16_t len)
 {
-    uint16_t vid, pid;
-    tuh_vid_pid_get(dev_addr, &vid, &pid);
-
-
-    fetch_device_string_descriptors(dev_addr);
-
-    set_attached_device_vid_pid(vid, pid);
-
-
-    host_mouse_has_report_id = false;
-    host_mouse_report_id = 0;
-    if (desc_report != NULL && desc_len > 0)
+    if (!hid_request_matches(dev_addr, instance))
     {
-        size_t copy_len = desc_len;
-        if (copy_len > sizeof(host_mouse_desc))
-            copy_len = sizeof(host_mouse_desc);
-        memcpy(host_mouse_desc, desc_report, copy_len);
-        host_mouse_desc_len = copy_len;
-
-
-        for (size_t i = 0; i + 1 < host_mouse_desc_len; ++i)
-        {
-            if (host_mouse_desc[i] == 0x85)
-            {
-                host_mouse_has_report_id = true;
-                host_mouse_report_id = host_mouse_desc[i + 1];
-                break;
-            }
-        }
+        return;
+    }
 
+    (void)report_type;
 
-        build_runtime_hid_report_with_mouse(host_mouse_desc, host_mouse_desc_len);
+    hid_request_t const *request = &hid_request_state.current;
+    uint16_t const id_bytes = report_id ? 1 : 0;
+    if (len > id_bytes)
+    {
+        forward_stats.forwarded++;
+        post_get_answer(request, request->data, TU_MIN(len, request->len));
     }
     else
     {
-        host_mouse_desc_len = 0;
+        forward_stats.failed++;
+        post_get_answer(request, NULL, 0);
     }
-
-    uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
+    finish_hid_request();
+}
 
 
+bool tud_hid_set_idle_cb(uint8_t instance, uint8_t idle_rate)
+{
+    if (instance != device_mouse_itf)
+    {
+        return true; // Keyboard reports go out on change only
+    }
 
+    idle_interval_ms = (uint16_t)(idle_rate * HID_IDLE_RATE_UNIT_MS);
+    return true;
+}
 
-    handle_hid_device_connection(dev_addr, itf_protocol);
 
+// Host interface behind a device interface, when its reports are the device's own
+static bool route_device_itf(uint8_t itf, host_itf_ref_t *target)
+{
+    if (itf >= device_itf_count)
+    {
+        return false;
+    }
 
-    if (!tuh_hid_receive_report(dev_addr, instance))
+    switch (device_itfs[itf].role)
     {
+    case DEVICE_ITF_MOUSE:
+        *target = mirror_mouse_ref;
+        return mirror_mouse_ref.valid && identity.report_desc_len != 0;
 
-        neopixel_trigger_usb_disconnection_flash();
-    }
-    else
+    case DEVICE_ITF_MIRROR:
     {
+        uint8_t const slot = device_itfs[itf].host_slot;
+        *target = (host_itf_ref_t){mirror_itfs[slot].active, mirror_itfs[slot].dev_addr, mirror_itfs[slot].instance, slot};
+        return target->valid;
+    }
 
-        neopixel_update_status();
+    default:
+        return false; // The keyboard is our own NKRO layout
     }
-    neopixel_update_status();
 }
 
-void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance)
+static bool queue_hid_request(uint8_t kind, const host_itf_ref_t *target, uint8_t seq, uint8_t report_id,
+                              uint8_t report_type, const uint8_t *data, uint16_t len)
 {
-    (void)instance; // Suppress unused parameter warning
-
-
-    reset_device_string_descriptors();
+    uint16_t const id_bytes = report_id ? 1 : 0;
+    hid_request_t *request = hid_request_queue.reserve();
+    if (request == NULL || len + id_bytes > sizeof(request->data))
+    {
+        forward_stats.dropped++;
+        return false;
+    }
 
+    request->kind = kind;
+    request->dev_addr = target ? target->dev_addr : 0;
+    request->instance = target ? target->instance : 0;
+    request->seq = seq;
+    request->report_id = report_id;
+    request->report_type = report_type;
+    request->len = (uint16_t)(len + id_bytes);
+    request->data[0] = report_id;
+    if (data != NULL)
+    {
+        memcpy(&request->data[id_bytes], data, len);
+    }
+    hid_request_queue.publish();
+    forward_stats.queued++;
+    return true;
+}
 
-    handle_device_disconnection(dev_addr);
+// Mirrored interfaces with an interrupt OUT endpoint take OUT reports through it
+static bool queue_mirror_out(uint8_t itf, const uint8_t *data, uint16_t len)
+{
+    if (itf >= device_itf_count || device_itfs[itf].role != DEVICE_ITF_MIRROR || !device_itfs[itf].has_out)
+    {
+        return false;
+    }
 
+    uint8_t const slot = device_itfs[itf].host_slot;
+    if (!mirror_itfs[slot].active)
+    {
+        return false;
+    }
 
-    neopixel_trigger_usb_disconnection_flash();
-    neopixel_update_status();
+    mirror_report_t *report = mirror_out_queues[slot].reserve();
+    if (report == NULL || len > sizeof(report->data))
+    {
+        mirror_stats.out_dropped++;
+        return true;
+    }
+    report->dev_addr = mirror_itfs[slot].dev_addr;
+    report->instance = mirror_itfs[slot].instance;
+    report->len = (uint8_t)len;
+    memcpy(report->data, data, len);
+    mirror_out_queues[slot].publish();
+    return true;
 }
 
-void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, const uint8_t *report, uint16_t len)
+// Resolution Multiplier. A mirrored descriptor leaves it to the PC, whose setting
+// goes on to the mouse; behind our own descriptor the mouse runs at its highest
+// resolution and kmbox rescales to whatever the PC has set.
+static void set_output_scroll(uint8_t wheel, uint8_t pan)
 {
+    output_scroll = (scroll_resolution_t){wheel, pan};
+    kmbox_set_scroll_resolution(wheel, pan);
+}
 
-    if (report == NULL || len == 0)
+static void queue_host_multiplier(const host_itf_ref_t *target, const hid_report_plan_t *plan,
+                                  const uint8_t *report, uint16_t len)
+{
+    scroll_resolution_t resolution;
+    if (!hid_multiplier_decode(plan, report, len, &resolution.wheel, &resolution.pan))
     {
-        tuh_hid_receive_report(dev_addr, instance);
         return;
     }
 
-    uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
-
-
-    switch (itf_protocol)
+    uint8_t const id_bytes = plan->uses_report_ids ? 1 : 0;
+    if (queue_hid_request(HID_REQUEST_SET_MULTIPLIER, target, 0, id_bytes ? report[0] : 0, HID_REPORT_TYPE_FEATURE,
+                          &report[id_bytes], (uint16_t)(len - id_bytes)))
     {
+        slot_scroll_pending[target->slot] = resolution;
+    }
+}
 
-    case HID_ITF_PROTOCOL_MOUSE:
+static void apply_host_multiplier(const host_itf_slot_t *slot)
+{
+    slot_scroll[slot->index] = (scroll_resolution_t){1, 1};
 
-        if (len > 0)
+    uint8_t report[HID_PLAN_MAX_REPORT_BYTES];
+    if (identity.report_desc_len == 0)
+    {
+        uint16_t const len = hid_multiplier_build(&slot->mouse.plan, true, report);
+        if (len != 0)
         {
+            queue_host_multiplier(&mirror_mouse_ref, &slot->mouse.plan, report, len);
+        }
+        return;
+    }
 
-            hid_mouse_report_t mouse_report_local = {0};
-
-            if (len == 8)
-            {
+    // Same descriptor and no re-enumeration: a replugged mouse gets the PC's setting back
+    if (multiplier_report_len != 0 && identity.report_desc_len == served_identity.report_desc_len &&
+        memcmp(identity.report_desc, served_identity.report_desc, identity.report_desc_len) == 0)
+    {
+        queue_host_multiplier(&mirror_mouse_ref, &device_mouse_plan, multiplier_report, multiplier_report_len);
+    }
+}
 
+// Every multiplier starts at its lowest setting after an enumeration
+static void reset_scroll_resolution(void)
+{
+    multiplier_report_len = 0;
+    set_output_scroll(1, 1);
 
-                mouse_report_local.buttons = report[0];
+    uint8_t report[HID_PLAN_MAX_REPORT_BYTES];
+    uint16_t const len = hid_multiplier_build(&device_mouse_plan, false, report);
+    if (mirror_mouse_ref.valid && identity.report_desc_len != 0 && len != 0)
+    {
+        queue_host_multiplier(&mirror_mouse_ref, &device_mouse_plan, report, len);
+    }
+}
 
+static bool set_mouse_multiplier(uint8_t report_id, const uint8_t *buffer, uint16_t bufsize)
+{
+    uint16_t const id_bytes = report_id ? 1 : 0;
+    if (bufsize + id_bytes > sizeof(multiplier_report))
+    {
+        return false;
+    }
 
-                int16_t x16 = (int16_t)(report[4] | (report[5] << 8));
-                int16_t y16 = (int16_t)(report[6] | (report[7] << 8));
+    uint8_t report[HID_PLAN_MAX_REPORT_BYTES];
+    report[0] = report_id;
+    memcpy(&report[id_bytes], buffer, bufsize);
 
+    uint16_t const len = (uint16_t)(bufsize + id_bytes);
+    scroll_resolution_t resolution;
+    if (!hid_multiplier_decode(&device_mouse_plan, report, len, &resolution.wheel, &resolution.pan))
+    {
+        return false;
+    }
 
+    memcpy(multiplier_report, report, len);
+    multiplier_report_len = len;
+    set_output_scroll(resolution.wheel, resolution.pan);
 
+    host_itf_ref_t target;
+    if (route_device_itf(device_mouse_itf, &target))
+    {
+        queue_host_multiplier(&target, &device_mouse_plan, report, len);
+    }
+    return true;
+}
 
+static uint16_t get_mouse_multiplier(uint8_t report_id, uint8_t *buffer, uint16_t reqlen)
+{
+    uint8_t report[HID_PLAN_MAX_REPORT_BYTES];
+    uint16_t len = multiplier_report_len;
+    if (len != 0)
+        memcpy(report, multiplier_report, len);
+    else
+        len = hid_multiplier_build(&device_mouse_plan, false, report);
 
+    uint16_t const id_bytes = device_mouse_plan.uses_report_ids ? 1 : 0;
+    if (len <= id_bytes || (id_bytes && report[0] != report_id))
+    {
+        return 0;
+    }
 
+    len = TU_MIN((uint16_t)(len - id_bytes), reqlen);
+    memcpy(buffer, &report[id_bytes], len);
+    return len;
+}
 
+// Forwarded interfaces never get here; their GET_REPORT is answered by
+// begin_forwarded_get once the attached device has
+uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen)
+{
+    if (instance == device_mouse_itf && report_type == HID_REPORT_TYPE_FEATURE)
+    {
+        return get_mouse_multiplier(report_id, buffer, reqlen); // Our own descriptor's multiplier
+    }
+    return 0;
+}
 
 
-                mouse_report_local.x = (x16 > 127) ? 127 : ((x16 < -128) ? -128 : (int8_t)x16);
-                mouse_report_local.y = (y16 > 127) ? 127 : ((y16 < -128) ? -128 : (int8_t)y16);
+// A GET_REPORT for a forwarded interface waits for the attached device's answer.
+// The control data stage stays unprimed meanwhile, so the PC sees NAKs, and it
+// is finished from hid_event_task with that answer or stalled.
+static struct
+{
+    bool active;
+    uint8_t rhport;
+    uint8_t seq;
+    uint32_t started_ms;
+    tusb_control_request_t request;
+    uint8_t data[HID_PLAN_MAX_REPORT_BYTES];    // The data stage sends from here
+} pending_get;                                  // Core 0
+
+static void stall_control_request(uint8_t rhport)
+{
+    usbd_edpt_stall(rhport, 0);
+    usbd_edpt_stall(rhport, TUSB_DIR_IN_MASK);
+}
 
+static bool begin_forwarded_get(uint8_t rhport, const tusb_control_request_t *request, const host_itf_ref_t *target)
+{
+    uint8_t const report_type = tu_u16_high(request->wValue);
+    uint8_t const report_id = tu_u16_low(request->wValue);
+    uint16_t const id_bytes = report_id ? 1 : 0;
+    uint16_t const len = TU_MIN(request->wLength, (uint16_t)HID_PLAN_MAX_REPORT_BYTES);
+    if (len <= id_bytes)
+    {
+        return false;
+    }
 
+    pending_get.seq++;
+    if (!queue_hid_request(HID_REQUEST_GET, target, pending_get.seq, report_id, report_type, NULL, (uint16_t)(len - id_bytes)))
+    {
+        forward_stats.get_stalled++;
+        return false;
+    }
+    pending_get.active = true;
+    pending_get.rhport = rhport;
+    pending_get.request = *request;
+    pending_get.started_ms = to_ms_since_boot(get_absolute_time());
+    return true;
+}
 
-                int8_t wheel = 0;
-                if (report[1] != 0)
-                    wheel = (int8_t)report[1];
-                else if (report[2] != 0)
-                    wheel = (int8_t)report[2];
-                else if (report[3] != 0)
-                    wheel = (int8_t)report[3];
+static void answer_forwarded_get(const hid_input_event_t *event)
+{
+    if (!pending_get.active || event->fetched.seq != pending_get.seq)
+    {
+        return; // The PC's request was already stalled or replaced
+    }
+    pending_get.active = false;
 
-                mouse_report_local.wheel = wheel;
-                mouse_report_local.pan = 0;
-            }
-            else
-            {
+    if (event->raw_len == 0)
+    {
+        forward_stats.get_stalled++;
+        stall_control_request(pending_get.rhport);
+        return;
+    }
 
-                size_t copy_sz = (len < sizeof(mouse_report_local)) ? len : sizeof(mouse_report_local);
-                memcpy(&mouse_report_local, report, copy_sz);
-            }
+    uint16_t const len = TU_MIN((uint16_t)event->raw_len, pending_get.request.wLength);
+    memcpy(pending_get.data, event->raw, len);
+    tud_control_xfer(pending_get.rhport, &pending_get.request, pending_get.data, len);
+    forward_stats.get_answered++;
+}
 
+static void expire_forwarded_get(void)
+{
+    if (pending_get.active && to_ms_since_boot(get_absolute_time()) - pending_get.started_ms >= HID_GET_REPORT_TIMEOUT_MS)
+    {
+        pending_get.active = false;
+        forward_stats.get_stalled++;
+        stall_control_request(pending_get.rhport);
+    }
+}
 
+// TinyUSB's HID driver with GET_REPORT for forwarded interfaces taken over. It
+// is registered as an application driver, so it opens the HID interfaces first.
+static bool forwarding_hid_control_xfer_cb(uint8_t rhport, uint8_t stage, tusb_control_request_t const *request)
+{
+    if (stage == CONTROL_STAGE_SETUP && request->bmRequestType_bit.type == TUSB_REQ_TYPE_CLASS)
+    {
+        pending_get.active = false; // Any new request means the PC gave up on the old one
 
-            process_mouse_report(&mouse_report_local);
+        host_itf_ref_t target;
+        if (request->bRequest == HID_REQ_CONTROL_GET_REPORT && route_device_itf(tu_u16_low(request->wIndex), &target))
+        {
+            return begin_forwarded_get(rhport, request, &target);
         }
-        break;
-
-    default:
-
-        break;
     }
+    return hidd_control_xfer_cb(rhport, stage, request);
+}
 
-
-    tuh_hid_receive_report(dev_addr, instance);
+static void forwarding_hid_reset(uint8_t rhport)
+{
+    pending_get.active = false;
+    hidd_reset(rhport);
 }
 
+static usbd_class_driver_t const forwarding_hid_driver = {
+    .init = hidd_init,
+    .deinit = hidd_deinit,
+    .reset = forwarding_hid_reset,
+    .open = hidd_open,
+    .control_xfer_cb = forwarding_hid_control_xfer_cb,
+    .xfer_cb = hidd_xfer_cb,
+    .sof = NULL,
+};
 
-uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, uint8_t *buffer, uint16_t reqlen)
+usbd_class_driver_t const *usbd_app_driver_get_cb(uint8_t *driver_count)
 {
-    (void)instance;
-    (void)report_id;
-    (void)report_type;
-    (void)buffer;
-    (void)reqlen;
-    return 0;
+    *driver_count = 1;
+    return &forwarding_hid_driver;
 }
 
 void tud_hid_set_report_cb(uint8_t instance, uint8_t report_id, hid_report_type_t report_type, const uint8_t *buffer, uint16_t bufsize)
 {
-    (void)instance;
+    if (buffer == NULL || bufsize == 0)
+    {
+        return;
+    }
+
+    if (instance == device_keyboard_itf)
+    {
+        if (report_type == HID_REPORT_TYPE_OUTPUT)
+        {
+            caps_lock_state = (buffer[0] & KEYBOARD_LED_CAPSLOCK) != 0;
+            queue_hid_request(HID_REQUEST_SET_LEDS, NULL, 0, 0, HID_REPORT_TYPE_OUTPUT, buffer, 1);
+        }
+        return;
+    }
+
+    if (instance == device_mouse_itf && report_type == HID_REPORT_TYPE_FEATURE &&
+        set_mouse_multiplier(report_id, buffer, bufsize))
+    {
+        return;
+    }
+
+    // Interrupt OUT data arrives without a report ID argument, the ID still in the buffer
+    if (report_id == 0 && report_type != HID_REPORT_TYPE_FEATURE && queue_mirror_out(instance, buffer, bufsize))
+    {
+        return;
+    }
+
+    host_itf_ref_t target;
+    if (route_device_itf(instance, &target))
+    {
+        queue_hid_request(HID_REQUEST_SET, &target, 0, report_id, (uint8_t)report_type, buffer, bufsize);
+    }
 }
 
 void tud_hid_report_complete_cb(uint8_t instance, const uint8_t *report, uint16_t len)
 {
-    (void)instance;
     (void)len;
     (void)report;
+
+    if (instance != device_mouse_itf || !staged_report.in_flight)
+    {
+        return;
+    }
+
+
+    staged_report.in_flight = false;
+    kmbox_commit_mouse_report(staged_report.buttons, staged_report.x, staged_report.y,
+                              staged_report.wheel, staged_report.pan);
+    frame_last_buttons = staged_report.buttons;
+
+    backpressure_stats.committed++;
+    backpressure_stats.committed_x += staged_report.x;
+    backpressure_stats.committed_y += staged_report.y;
 }
 
 bool usb_device_stack_reset(void)
@@ -1006,7 +3294,7 @@ uint8_t const *tud_descriptor_device_cb(void)
 
         .iManufacturer = 0x01,
         .iProduct = 0x02,
-        .iSerialNumber = attached_has_serial ? 0x03 : 0x00,
+        .iSerialNumber = (uint8_t)(identity_string_present(identity.strings[IDENTITY_STRING_SERIAL]) ? 0x03 : 0x00),
 
         .bNumConfigurations = 0x01};
 
@@ -1014,37 +3302,80 @@ uint8_t const *tud_descriptor_device_cb(void)
 }
 
 
-uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
+static const uint8_t *device_itf_report_desc(uint8_t itf, uint16_t *len)
 {
-    (void)instance;
-    if (desc_hid_runtime_valid)
+    if (itf >= device_itf_count)
+    {
+        *len = 0;
+        return NULL;
+    }
+
+    switch (device_itfs[itf].role)
+    {
+    case DEVICE_ITF_KEYBOARD:
+        *len = sizeof(desc_hid_keyboard_report);
+        return desc_hid_keyboard_report;
+
+    case DEVICE_ITF_MIRROR:
     {
-        return desc_hid_report_runtime;
+        mirror_itf_t const *mirror = &mirror_itfs[device_itfs[itf].host_slot];
+        *len = mirror->desc_len;
+        return mirror->desc;
+    }
+
+    default:
+        *len = (uint16_t)desc_hid_runtime_len;
+        return desc_hid_report_runtime; // Mirrored mouse descriptor or the default
     }
+}
 
-    return desc_hid_report_runtime; // still points to buffer (may contain defaults)
+uint8_t const *tud_hid_descriptor_report_cb(uint8_t instance)
+{
+    uint16_t len;
+    return device_itf_report_desc(instance, &len);
 }
 
 
-enum
+// Built from device_itfs on every request; the interface set only changes across a re-enumeration
+uint8_t const *tud_descriptor_configuration_cb(uint8_t index)
 {
-    ITF_NUM_HID,
-    ITF_NUM_TOTAL
-};
+    (void)index; // for multiple configurations
 
-uint8_t const desc_configuration[] =
+    static uint8_t desc_configuration_runtime[CONFIG_MAX_LEN];
+    uint16_t total_len = TUD_CONFIG_DESC_LEN;
+    for (uint8_t itf = 0; itf < device_itf_count; itf++)
     {
+        total_len = (uint16_t)(total_len + (device_itfs[itf].has_out ? TUD_HID_INOUT_DESC_LEN : TUD_HID_DESC_LEN));
+    }
 
-        TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, 0, CONFIG_TOTAL_LEN, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, USB_CONFIG_POWER_MA),
-
+    uint8_t const desc_config[] = {
+        TUD_CONFIG_DESCRIPTOR(1, device_itf_count, 0, total_len, TUSB_DESC_CONFIG_ATT_REMOTE_WAKEUP, USB_CONFIG_POWER_MA)};
+    memcpy(desc_configuration_runtime, desc_config, sizeof(desc_config));
 
-        TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, HID_POLLING_INTERVAL_MS)};
+    uint8_t *pos = desc_configuration_runtime + sizeof(desc_config);
+    for (uint8_t itf = 0; itf < device_itf_count; itf++)
+    {
+        uint16_t report_len;
+        device_itf_report_desc(itf, &report_len);
 
+        uint8_t const ep_in = (uint8_t)(EPNUM_HID + itf);
+        if (device_itfs[itf].has_out)
+        {
+            uint8_t const desc_hid[] = {
+                TUD_HID_INOUT_DESCRIPTOR(itf, 0, HID_ITF_PROTOCOL_NONE, report_len, (uint8_t)(ep_in & ~TUSB_DIR_IN_MASK),
+                                         ep_in, device_itfs[itf].ep_size, device_itfs[itf].ep_interval)};
+            memcpy(pos, desc_hid, sizeof(desc_hid));
+            pos += sizeof(desc_hid);
+            continue;
+        }
 
-uint8_t const *tud_descriptor_configuration_cb(uint8_t index)
-{
-    (void)index; // for multiple configurations
-    return desc_configuration;
+        uint8_t const desc_hid[] = {
+            TUD_HID_DESCRIPTOR(itf, 0, HID_ITF_PROTOCOL_NONE, report_len, ep_in,
+                               device_itfs[itf].ep_size, device_itfs[itf].ep_interval)};
+        memcpy(pos, desc_hid, sizeof(desc_hid));
+        pos += sizeof(desc_hid);
+    }
+    return desc_configuration_runtime;
 }
 
 
@@ -1106,45 +3437,21 @@ uint16_t const *tud_descriptor_string_cb(uint8_t index, uint16_t langid)
             return NULL;
         }
 
-        const char *str = string_desc_arr[index];
-        if (str == NULL)
+        // Identity strings are kept encoded, so they go out as they are
+        uint16_t const *desc = identity.strings[index - STRING_DESC_MANUFACTURER_IDX];
+        if (identity_string_present(desc))
         {
-            return NULL;
+            return desc;
         }
 
-
-        if (string_descriptors_fetched)
+        const char *str = string_desc_arr[index];
+        if (str == NULL)
         {
-            switch (index)
-            {
-            case STRING_DESC_MANUFACTURER_IDX:
-                str = attached_manufacturer;
-                break;
-            case STRING_DESC_PRODUCT_IDX:
-                str = attached_product;
-                break;
-            case STRING_DESC_SERIAL_IDX:
-                if (attached_has_serial && strlen(attached_serial) > 0)
-                {
-                    str = attached_serial;
-                }
-                else
-                {
-                    str = get_dynamic_serial_string();
-                }
-                break;
-            default:
-
-                break;
-            }
+            return NULL;
         }
-        else
+        if (index == STRING_DESC_SERIAL_IDX)
         {
-
-            if (index == STRING_DESC_SERIAL_IDX)
-            {
-                str = get_dynamic_serial_string();
-            }
+            str = get_dynamic_serial_string();
         }
 
 
@@ -28,6 +28,7 @@
 #include "pio_usb.h"
 #include "hardware/clocks.h"
 #include "pico/multicore.h"
+#include "pico/flash.h"
 #include "tusb.h"
 #endif
 
@@ -107,6 +108,9 @@ static void core1_main(void) {
 
     sleep_ms(10);
     
+    // Lets core 0 park this core while it writes the identity cache
+    flash_safe_execute_core_init();
+    
 
     pio_usb_configuration_t pio_cfg = PIO_USB_DEFAULT_CONFIG;
     pio_cfg.pin_dp = PIN_USB_HOST_DP;
@@ -116,6 +120,9 @@ static void core1_main(void) {
     tuh_configure(USB_HOST_PORT, TUH_CFGID_RPI_PIO_USB_CONFIGURATION, &pio_cfg);
     
 
+    tuh_hid_set_default_protocol(HID_PROTOCOL_REPORT);
+    
+
     tuh_init(USB_HOST_PORT);
     
 
@@ -135,6 +142,7 @@ static void core1_task_loop(void) {
     
     while (true) {
         tuh_task();
+        hid_host_task();
         
 
         if (++heartbeat_counter >= heartbeat_check_threshold) {
@@ -291,6 +299,7 @@ static void main_application_loop(void) {
     while (true) {
 
         tud_task();
+        hid_event_task();
         hid_device_task();
         
 
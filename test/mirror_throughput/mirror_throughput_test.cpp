@@ -0,0 +1,277 @@
+/*
+ * Mirror Queue Throughput Test
+ * Runs the firmware's mirror pacing (mirror_pacing.h) and queues on the host, in
+ * a frame-by-frame model of the paths around them in usb_hid.cpp. Every vendor
+ * interface of the attached device reports every frame, the PC writes to each
+ * of them every frame, and core 0 stalls now and then; the mouse must still
+ * lose nothing, and the vendor interfaces must share what is left evenly.
+ */
+
+#include "defines.h"
+#include "tusb_config.h"
+#include "spsc_queue.h"
+#include "mirror_pacing.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+
+#define TEST_FRAMES             5000u
+#define TEST_PASSES_PER_FRAME   8u                      // Core 1 main loop passes per 1 ms frame
+#define TEST_US_PER_PASS        (1000u / TEST_PASSES_PER_FRAME)
+#define TEST_VENDOR_ITFS        (CFG_TUH_HID - 1)       // Every host slot but the mouse's
+#define TEST_STALL_PERIOD       250u                    // Frames between core 0 stalls
+#define TEST_FAIR_SPREAD        (TEST_FRAMES / 100u)    // Most any vendor interface may trail another by
+
+// Long enough for the vendor reports to fill the event queue up to the headroom,
+// and for the mouse to use half of what is left after that
+#define TEST_STALL_FRAMES       ((HID_EVENT_QUEUE_DEPTH - HID_MIRROR_EVENT_HEADROOM) / (1 + TEST_VENDOR_ITFS) + \
+                                 HID_MIRROR_EVENT_HEADROOM / 2)
+
+static_assert(TEST_VENDOR_ITFS > HID_MIRROR_IN_PER_FRAME, "Vendor reports must outrun the per-frame budget");
+static_assert(TEST_STALL_FRAMES < TEST_STALL_PERIOD, "Stalls must not overlap");
+
+
+#define MOUSE_SLOT 0
+
+
+typedef struct {
+    uint8_t slot;
+    uint32_t frame;                     // When core 1 took it off the host bus
+} test_event_t;
+
+typedef struct {
+    uint32_t frame;
+} test_report_t;
+
+typedef struct {
+    uint32_t mouse_reports;             // Off the host bus
+    uint32_t mouse_lost;                // Found the event queue full
+    uint32_t mouse_sent;                // To the PC
+    uint32_t mouse_max_frames;          // From the host bus to the PC
+    uint32_t vendor_reports;
+    uint32_t in_sent;
+    uint32_t in_queued;
+    uint32_t in_dropped;                // Per-interface queue full
+    uint32_t in_throttled;              // Kept out of the event queue's headroom
+    uint32_t in_lost;                   // Found the event queue full
+    uint32_t in_max_per_frame;
+    uint32_t in_sent_by_slot[CFG_TUH_HID];
+    uint32_t out_written;               // By the PC
+    uint32_t out_sent;                  // To the attached device
+    uint32_t out_dropped;
+    uint32_t out_max_per_frame;
+    uint32_t out_sent_by_slot[CFG_TUH_HID];
+} test_result_t;
+
+
+// One run of the model; headroom stands in for HID_MIRROR_EVENT_HEADROOM so the
+// same load can be run without it for comparison
+class mirror_model {
+public:
+    explicit mirror_model(uint32_t headroom) : headroom_(headroom) {}
+
+    test_result_t run()
+    {
+        for (uint32_t frame = 0; frame < TEST_FRAMES; frame++) {
+            bool const stalled = frame % TEST_STALL_PERIOD >= TEST_STALL_PERIOD - TEST_STALL_FRAMES;
+            if (!stalled) {
+                core0_sof(frame);
+                pc_writes();
+            }
+            out_this_frame_ = 0;
+
+            for (uint32_t pass = 0; pass < TEST_PASSES_PER_FRAME; pass++) {
+                core1_pass(frame, pass);
+                if (!stalled) {
+                    core0_events(frame);
+                }
+            }
+        }
+        return result_;
+    }
+
+private:
+    // report_received_cb: one report per interface and frame off the host bus,
+    // then mirror_out_task
+    void core1_pass(uint32_t frame, uint32_t pass)
+    {
+        if (pass <= TEST_VENDOR_ITFS) {
+            uint8_t const slot = (uint8_t)pass;
+            bool const is_mouse = slot == MOUSE_SLOT;
+            if (is_mouse) {
+                result_.mouse_reports++;
+            } else {
+                result_.vendor_reports++;
+            }
+
+            if (!mirror_admit(events_.depth(), !is_mouse, headroom_)) {
+                result_.in_throttled++;
+            } else if (!events_.push({ slot, frame })) {
+                if (is_mouse) {
+                    result_.mouse_lost++;
+                } else {
+                    result_.in_lost++;
+                }
+            }
+        }
+
+        // The attached device's OUT endpoints always take a report
+        out_.run(frame * 1000u + pass * TEST_US_PER_PASS, out_queues_, [this](uint8_t slot, const test_report_t &) {
+            result_.out_sent++;
+            result_.out_sent_by_slot[slot]++;
+            if (++out_this_frame_ > result_.out_max_per_frame) {
+                result_.out_max_per_frame = out_this_frame_;
+            }
+            return MIRROR_SENT;
+        });
+    }
+
+    // The SOF stage: the mouse first, then flush_mirror_reports
+    void core0_sof(uint32_t frame)
+    {
+        if (mouse_pending_) {
+            mouse_pending_ = false;
+            result_.mouse_sent++;
+            if (frame - mouse_oldest_ > result_.mouse_max_frames) {
+                result_.mouse_max_frames = frame - mouse_oldest_;
+            }
+        }
+
+        in_this_frame_ = 0;
+        in_.flush(in_queues_, [this, frame](uint8_t slot, const test_report_t &) {
+            return send_mirror_report(slot, frame) ? MIRROR_SENT : MIRROR_DEFERRED;
+        });
+    }
+
+    // queue_mirror_out, for a PC writing to every vendor interface each frame
+    void pc_writes()
+    {
+        for (uint8_t slot = 1; slot <= TEST_VENDOR_ITFS; slot++) {
+            result_.out_written++;
+            if (!out_queues_[slot].push({ 0 })) {
+                result_.out_dropped++;
+            }
+        }
+    }
+
+    // hid_event_task and forward_itf_report
+    void core0_events(uint32_t frame)
+    {
+        test_event_t event;
+        while (events_.pop(&event)) {
+            if (event.slot == MOUSE_SLOT) {
+                if (!mouse_pending_) {
+                    mouse_pending_ = true;
+                    mouse_oldest_ = event.frame;
+                }
+                continue;
+            }
+
+            spsc_queue<test_report_t, HID_MIRROR_QUEUE_DEPTH> *queue = &in_queues_[event.slot];
+            if (in_queues_[event.slot].empty() && send_mirror_report(event.slot, frame)) {
+                continue;
+            }
+            if (queue->push({ event.frame })) {
+                result_.in_queued++;
+            } else {
+                result_.in_dropped++;
+            }
+        }
+    }
+
+    // send_mirror_report: each mirrored endpoint takes one report per frame
+    bool send_mirror_report(uint8_t slot, uint32_t frame)
+    {
+        if (!in_.may_send() || itf_sent_[slot] == frame + 1) {
+            return false;
+        }
+        itf_sent_[slot] = frame + 1;
+        in_.spend();
+        result_.in_sent++;
+        result_.in_sent_by_slot[slot]++;
+        if (++in_this_frame_ > result_.in_max_per_frame) {
+            result_.in_max_per_frame = in_this_frame_;
+        }
+        return true;
+    }
+
+
+    uint32_t const headroom_;
+    test_result_t result_ = {};
+
+    spsc_queue<test_event_t, HID_EVENT_QUEUE_DEPTH> events_;
+    spsc_queue<test_report_t, HID_MIRROR_QUEUE_DEPTH> in_queues_[CFG_TUH_HID];
+    spsc_queue<test_report_t, HID_MIRROR_QUEUE_DEPTH> out_queues_[CFG_TUH_HID];
+    mirror_in_pacer<CFG_TUH_HID> in_;
+    mirror_out_pacer<CFG_TUH_HID> out_;
+
+    bool mouse_pending_ = false;
+    uint32_t mouse_oldest_ = 0;
+    uint32_t itf_sent_[CFG_TUH_HID] = {};  // Frame + 1 of the last report on each endpoint
+    uint32_t in_this_frame_ = 0;
+    uint32_t out_this_frame_ = 0;
+};
+
+
+// Largest difference between what two vendor interfaces got
+static uint32_t spread(const uint32_t *by_slot)
+{
+    uint32_t min = UINT32_MAX;
+    uint32_t max = 0;
+    for (uint8_t slot = 1; slot <= TEST_VENDOR_ITFS; slot++) {
+        min = by_slot[slot] < min ? by_slot[slot] : min;
+        max = by_slot[slot] > max ? by_slot[slot] : max;
+    }
+    return max - min;
+}
+
+static void print_result(const char *name, const test_result_t *r)
+{
+    printf("%s:\n", name);
+    printf("  mouse   %u reports, %u sent, %u lost, at most %u frames to the PC\n",
+           r->mouse_reports, r->mouse_sent, r->mouse_lost, r->mouse_max_frames);
+    printf("  IN      %u reports, %u sent, %u queued, %u dropped, %u throttled, %u lost, at most %u per frame, spread %u\n",
+           r->vendor_reports, r->in_sent, r->in_queued, r->in_dropped, r->in_throttled, r->in_lost,
+           r->in_max_per_frame, spread(r->in_sent_by_slot));
+    printf("  OUT     %u written, %u sent, %u dropped, at most %u per frame, spread %u\n",
+           r->out_written, r->out_sent, r->out_dropped, r->out_max_per_frame, spread(r->out_sent_by_slot));
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+int main(void)
+{
+    printf("%u vendor interfaces reporting every frame, core 0 stalled %u of every %u frames\n",
+           (unsigned)TEST_VENDOR_ITFS, (unsigned)TEST_STALL_FRAMES, TEST_STALL_PERIOD);
+
+    test_result_t const with = mirror_model(HID_MIRROR_EVENT_HEADROOM).run();
+    test_result_t const without = mirror_model(0).run();
+    print_result("HID_MIRROR_EVENT_HEADROOM", &with);
+    print_result("no headroom", &without);
+
+    check(with.in_throttled > 0, "vendor traffic never reached the headroom");
+    check(with.mouse_lost == 0, "mouse reports lost with the headroom");
+    check(with.mouse_max_frames <= TEST_STALL_FRAMES + 1, "mouse reports held past the stall");
+    check(with.in_max_per_frame <= HID_MIRROR_IN_PER_FRAME, "mirrored IN reports over the per-frame budget");
+    check(with.out_max_per_frame <= (1000u + HID_MIRROR_OUT_INTERVAL_US - 1) / HID_MIRROR_OUT_INTERVAL_US,
+          "OUT reports closer together than HID_MIRROR_OUT_INTERVAL_US");
+    check(spread(with.in_sent_by_slot) <= TEST_FAIR_SPREAD, "mirrored IN reports not shared round-robin");
+    check(spread(with.out_sent_by_slot) <= TEST_FAIR_SPREAD, "OUT reports not shared round-robin");
+    check(without.mouse_lost > 0, "the load does not need the headroom; it tests nothing");
+
+    if (failures != 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("PASS\n");
+    return 0;
+}